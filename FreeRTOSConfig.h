@@ -83,7 +83,7 @@ your application. */
 #define configUSE_TICKLESS_IDLE                 0
 #define configCPU_CLOCK_HZ                      SystemCoreClock
 #define configRTC_CLOCK_HZ                      32768
-#define configTICK_RATE_HZ                      100
+#define configTICK_RATE_HZ                      1000 /* 1 ms steps for the gdb halt poller */
 #define configMAX_PRIORITIES                    5
 #define configMINIMAL_STACK_SIZE                256
 #define configMAX_TASK_NAME_LEN                 16
@@ -103,6 +103,11 @@ your application. */
 /* Memory allocation related definitions. */
 #define configSUPPORT_STATIC_ALLOCATION         0
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
+/*
+ * Task stacks (about 6.5 KB) and the gdb packet buffers (about 5.3 KB with
+ * the default GDB_PACKET_BUFF_SIZE) come from here, the rest of the 32 KB
+ * SRAM of the GD32VF103 is static data and the main stack.
+ */
 #define configTOTAL_HEAP_SIZE                   20*1024
 #define configAPPLICATION_ALLOCATED_HEAP        0
 
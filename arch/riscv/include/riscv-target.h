@@ -60,17 +60,28 @@ typedef enum {
     rv_target_breakpoint_type_unused = 5,
 } rv_target_breakpoint_type_t;
 
+/*
+ * Who wants a breakpoint in: a software breakpoint stays in the hart until
+ * every owner has removed it. Hardware breakpoints only ever belong to GDB.
+ */
+#define RV_TARGET_BREAKPOINT_OWNER_GDB      (1)
+#define RV_TARGET_BREAKPOINT_OWNER_TRACE    (2)
+
 typedef struct {
     rv_target_breakpoint_type_t type;
     uint64_t addr;
     uint32_t kind;
+    uint32_t match;     /* mcontrol match mode used for it */
+    uint32_t pending;   /* change not applied to the hart yet */
 } rv_hardware_breakpoint_t;
 
 typedef struct {
-    rv_target_breakpoint_type_t type;
     uint64_t addr;
-    uint32_t kind;
-    uint32_t inst;
+    uint32_t inst;      /* original instruction */
+    uint8_t kind;
+    uint8_t state;      /* free, used or deleted slot */
+    uint8_t pending;    /* change not applied to the hart yet */
+    uint8_t owners;     /* RV_TARGET_BREAKPOINT_OWNER_* that inserted it */
 } rv_software_breakpoint_t;
 
 typedef enum {
@@ -106,6 +117,9 @@ typedef enum {
 #define RV_CSR_DCSR_CAUSE_STEP               (4)
 #define RV_CSR_DCSR_CAUSE_RESET_HALT_REQ     (5)
 
+/* largest count of an icount trigger */
+#define RV_TARGET_ICOUNT_MAX                 (0x3fff)
+
 typedef enum{
     rv_target_halt_reason_running = 0,
     rv_target_halt_reason_hardware_breakpoint = 1,
@@ -220,6 +234,7 @@ void rv_target_init(void);
 void rv_target_deinit(void);
 uint32_t rv_target_misa(void);
 uint32_t rv_target_mxl(void);
+bool rv_target_sba_supported(void);
 uint64_t rv_target_vlenb(void);
 void rv_target_set_protocol(rv_target_protocol_t protocol);
 void rv_target_init_post(rv_target_error_t *err);
@@ -229,15 +244,22 @@ void rv_target_read_core_registers(void *regs);
 void rv_target_write_core_registers(void *regs);
 void rv_target_read_register(void *reg, uint32_t regno);
 void rv_target_write_register(void *reg, uint32_t regno);
+void rv_target_read_registers(uint64_t *regs, const uint32_t *regno, uint32_t num);
 void rv_target_read_memory(uint8_t *mem, uint64_t addr, uint32_t len);
+bool rv_target_read_memory_running(uint8_t *mem, uint64_t addr, uint32_t len);
 void rv_target_write_memory(const uint8_t *mem, uint64_t addr, uint32_t len);
+bool rv_target_write_memory_running(const uint8_t *mem, uint64_t addr, uint32_t len);
 void rv_target_reset(void);
 void rv_target_halt(void);
 void rv_target_halt_check(rv_target_halt_info_t *halt_info);
 void rv_target_resume(void);
 void rv_target_step(void);
-void rv_target_insert_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t *err);
-void rv_target_remove_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t *err);
+bool rv_target_step_wait(void);
+bool rv_target_step_count(uint32_t count);
+bool rv_target_sample_pc(uint64_t *pc);
+void rv_target_insert_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t owners, uint32_t *err);
+void rv_target_remove_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t owners, uint32_t *err);
+uint32_t rv_target_breakpoint_owners(rv_target_breakpoint_type_t type, uint64_t addr);
 
 /*===============================DM============================================*/
 /*==== debug module register ====*/
@@ -19,12 +19,86 @@
 #include "opcodes.h"
 #include "port.h"
 
+/*
+ * Register cache, valid while the hart stays halted. Entries 1..31 are the
+ * GPRs, 32 is the PC (dpc) and 33..64 the FPRs, matching RV_REG_*.
+ */
+#define RV_REG_CACHE_DCSR       (RV_REG_FT11 + 1)
+#define RV_REG_CACHE_MSTATUS    (RV_REG_FT11 + 2)
+#define RV_REG_CACHE_TSELECT    (RV_REG_FT11 + 3)
+#define RV_REG_CACHE_NUM        (RV_REG_FT11 + 4)
+
+#define RV_TARGET_BATCH_REG_NUM (8)
+
+#define RV_REG_CACHE_VALID      (1 << 0)
+#define RV_REG_CACHE_DIRTY      (1 << 1)
+
+/* breakpoint table entries not yet applied to the hart */
+#define RV_BREAKPOINT_PENDING_NONE      (0)
+#define RV_BREAKPOINT_PENDING_INSERT    (1)
+#define RV_BREAKPOINT_PENDING_REMOVE    (2)
+
+/*
+ * Software breakpoints live in an open addressing table keyed by address,
+ * deleted slots stay marked so later entries of a probe run are still found.
+ */
+#define RV_TARGET_SOFTWARE_BREAKPOINT_NUM \
+    (RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_MEM / sizeof(rv_software_breakpoint_t))
+
+#define RV_SOFTWARE_BREAKPOINT_FREE     (0)
+#define RV_SOFTWARE_BREAKPOINT_USED     (1)
+#define RV_SOFTWARE_BREAKPOINT_DELETED  (2)
+
+/* what a trigger can do, found out at connect */
+#define RV_TRIGGER_CAP_MCONTROL         (1 << 0)
+#define RV_TRIGGER_CAP_MCONTROL6        (1 << 1)
+#define RV_TRIGGER_CAP_NAPOT            (1 << 2)
+#define RV_TRIGGER_CAP_RANGE            (1 << 3)
+#define RV_TRIGGER_CAP_ICOUNT           (1 << 4)
+
+/* mcontrol and mcontrol6 share the low 16 bits of tdata1 */
+#define RV_MC_LOAD                      (1 << 0)
+#define RV_MC_STORE                     (1 << 1)
+#define RV_MC_EXECUTE                   (1 << 2)
+#define RV_MC_U                         (1 << 3)
+#define RV_MC_S                         (1 << 4)
+#define RV_MC_M                         (1 << 6)
+#define RV_MC_MATCH(x)                  ((x) << 7)
+#define RV_MC_CHAIN                     (1 << 11)
+#define RV_MC_ACTION_DEBUG              (1 << 12)
+#define RV_MC_HIT                       (1 << 20)
+#define RV_MC6_HIT                      (1 << 22)
+
+#define RV_MC_MATCH_EQUAL               (0)
+#define RV_MC_MATCH_NAPOT               (1)
+#define RV_MC_MATCH_GE                  (2)
+#define RV_MC_MATCH_LT                  (3)
+
+/* dcsr.step as last written to the hart, or unknown */
+#define RV_DCSR_STEP_UNKNOWN    (0xff)
+
 typedef struct {
     rv_dm_t dm;
     rv_tr32_t tr32;
     rv_tr64_t tr64;
     rv_dtm_t dtm;
     rv_dmi_t dmi;
+    bool dmi_pending;
+    uint32_t dmi_busy_delay;
+    bool abstractauto;
+    bool aampostincrement;
+    uint32_t *dmi_read_out;
+    bool sba;
+    uint32_t sba_access_mask;
+    uint32_t sba_asize;
+    uint64_t reg_cache[RV_REG_CACHE_NUM];
+    uint8_t reg_cache_state[RV_REG_CACHE_NUM];
+    uint8_t dcsr_step;
+    uint32_t trigger_num;
+    uint8_t trigger_cap[RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM];
+    uint8_t trigger_maskmax[RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM];
+    bool icount_active;
+    uint32_t icount_trigger;
     rv_misa_rv32_t misa;
     uint64_t vlenb;
     rv_target_protocol_t protocol;
@@ -41,7 +115,8 @@ const char *err_msg;
 uint32_t err_pc;
 uint64_t save_vtype, save_vl;
 rv_hardware_breakpoint_t hardware_breakpoints[RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM];
-rv_software_breakpoint_t software_breakpoints[RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM];
+rv_software_breakpoint_t software_breakpoints[RV_TARGET_SOFTWARE_BREAKPOINT_NUM];
+static uint32_t software_breakpoint_num;
 uint32_t rv_target_dr_post;
 uint32_t rv_target_dr_pre;
 uint32_t rv_target_ir_post;
@@ -102,71 +177,120 @@ static void rv_dtm_sync(uint32_t reg)
         default:
             break;
     }
-    if (target.dtm.dtmcs.idle) {
-        rv_tap_idle(target.dtm.dtmcs.idle);
+    if (target.dtm.dtmcs.idle + target.dmi_busy_delay) {
+        rv_tap_idle(target.dtm.dtmcs.idle + target.dmi_busy_delay);
     }
 }
 
-static void rv_dmi_read(uint32_t addr, uint32_t *out)
+static void rv_dmi_reset(void)
 {
-    uint32_t i;
+    target.dtm.dtmcs.dmireset = 1;
+    target.dmi.data = target.dtm.dtmcs.value;
+    rv_dtm_sync(RV_DTM_JTAG_REG_DTMCS);
+}
 
-    target.dmi.op = RV_DMI_OP_READ;
-    target.dmi.data = 0x00;
-    target.dmi.address = addr;
-    rv_dtm_sync(RV_DTM_JTAG_REG_DMI);
+/*
+ * Shift one operation into dmi. The DTM reports the result of an operation
+ * during the scan that follows it, so what comes back here (op/data) belongs
+ * to the previously issued operation, not to this one.
+ *
+ * BUSY means the previous operation had not finished yet and this one was
+ * dropped: clear the sticky error, give the DTM more idle cycles from now on
+ * and shift the same operation again.
+ */
+static void rv_dmi_exec(uint32_t op, uint32_t addr, uint32_t data)
+{
+    uint32_t i;
 
     for (i = 0; i < RV_TARGET_CONFIG_DMI_RETRIES; i++) {
-        target.dmi.op = RV_DMI_OP_NOP;
-        target.dmi.data = 0x00;
-        target.dmi.address = 0x00;
+        target.dmi.op = op;
+        target.dmi.data = data;
+        target.dmi.address = addr;
         rv_dtm_sync(RV_DTM_JTAG_REG_DMI);
-        if(target.dmi.op == RV_DMI_RESULT_BUSY) {
-            rv_tap_idle(32);
-        } else {
+        if (target.dmi.op != RV_DMI_RESULT_BUSY) {
             break;
         }
+        rv_dmi_reset();
+        target.dmi_busy_delay += (target.dmi_busy_delay >> 1) + 1;
+        rv_tap_idle(32);
     }
 
-    if(target.dmi.op != RV_DMI_RESULT_DONE) {
-        target.dtm.dtmcs.dmireset = 1;
-        target.dmi.data = target.dtm.dtmcs.value;
-        rv_dtm_sync(RV_DTM_JTAG_REG_DTMCS);
-    } else {
-        *out = target.dmi.data;
+    if (target.dmi.op != RV_DMI_RESULT_DONE) {
+        rv_dmi_reset();
     }
 
     result = target.dmi.op;
+    target.dmi_pending = (op != RV_DMI_OP_NOP);
 }
 
-static void rv_dmi_write(uint32_t addr, uint32_t in)
+/*
+ * Collect the result of the last posted operation.
+ */
+static void rv_dmi_flush(void)
 {
-    uint32_t i;
+    if (target.dmi_pending) {
+        rv_dmi_exec(RV_DMI_OP_NOP, 0x00, 0x00);
+    }
+}
+
+static void rv_dmi_read(uint32_t addr, uint32_t *out)
+{
+    rv_dmi_exec(RV_DMI_OP_READ, addr, 0x00);
+    if (result != RV_DMI_RESULT_DONE) {
+        return;
+    }
 
-    target.dmi.op = RV_DMI_OP_WRITE;
-    target.dmi.data = in;
-    target.dmi.address = addr;
-    rv_dtm_sync(RV_DTM_JTAG_REG_DMI);
+    rv_dmi_exec(RV_DMI_OP_NOP, 0x00, 0x00);
+    if (result == RV_DMI_RESULT_DONE) {
+        *out = target.dmi.data;
+    }
+}
 
-    for (i = 0; i < RV_TARGET_CONFIG_DMI_RETRIES; i++) {
-        target.dmi.op = RV_DMI_OP_NOP;
-        target.dmi.data = 0x00;
-        target.dmi.address = 0x00;
-        rv_dtm_sync(RV_DTM_JTAG_REG_DMI);
-        if(target.dmi.op == RV_DMI_RESULT_BUSY) {
-            rv_tap_idle(32);
-        } else {
+/*
+ * Read several DM registers back to back. The data of each read comes back
+ * in the scan that issues the next one, so only the last read needs a NOP.
+ */
+static void rv_dmi_read_pipelined(const uint32_t *addr, uint32_t *out, uint32_t num)
+{
+    uint32_t i;
+
+    rv_dmi_exec(RV_DMI_OP_READ, addr[0], 0x00);
+    for (i = 0; i < num; i++) {
+        if (result != RV_DMI_RESULT_DONE) {
             break;
         }
+        if (i + 1 < num) {
+            rv_dmi_exec(RV_DMI_OP_READ, addr[i + 1], 0x00);
+        } else {
+            rv_dmi_exec(RV_DMI_OP_NOP, 0x00, 0x00);
+        }
+        if (result == RV_DMI_RESULT_DONE) {
+            out[i] = target.dmi.data;
+        }
     }
+}
 
-    if(target.dmi.op != RV_DMI_RESULT_DONE) {
-        target.dtm.dtmcs.dmireset = 1;
-        target.dmi.data = target.dtm.dtmcs.value;
-        rv_dtm_sync(RV_DTM_JTAG_REG_DTMCS);
-    }
+/*
+ * Writes are posted: their status is checked by whatever scan comes next,
+ * use rv_dmi_flush() when nothing else follows.
+ */
+static void rv_dmi_write(uint32_t addr, uint32_t in)
+{
+    rv_dmi_exec(RV_DMI_OP_WRITE, addr, in);
+}
 
-    result = target.dmi.op;
+/*
+ * Queue one operation; when the result of a queued READ comes back (in the
+ * scan of the next operation) it is stored to the out pointer given with it.
+ * End a sequence with a NOP.
+ */
+static void rv_dmi_pipe(uint32_t op, uint32_t addr, uint32_t data, uint32_t *out)
+{
+    rv_dmi_exec(op, addr, data);
+    if (target.dmi_read_out && (result == RV_DMI_RESULT_DONE)) {
+        *target.dmi_read_out = target.dmi.data;
+    }
+    target.dmi_read_out = (op == RV_DMI_OP_READ) ? out : NULL;
 }
 
 static void rv_prep_for_register_access(uint32_t regno)
@@ -238,9 +362,9 @@ static void rv_register_read(uint32_t *reg, uint32_t regno)
         rv_dmi_read(RV_DM_ABSTRACT_DATA0, &target.dm.data[0]);
         reg[0] = target.dm.data[0];
     } else if (MXL_RV64 == mxl) {
-        rv_dmi_read(RV_DM_ABSTRACT_DATA0, &target.dm.data[0]);
+        const uint32_t data_addr[2] = {RV_DM_ABSTRACT_DATA0, RV_DM_ABSTRACT_DATA1};
+        rv_dmi_read_pipelined(data_addr, &target.dm.data[0], 2);
         reg[0] = target.dm.data[0];
-        rv_dmi_read(RV_DM_ABSTRACT_DATA1, &target.dm.data[1]);
         reg[1] = target.dm.data[1];
     }
 }
@@ -287,6 +411,188 @@ static void rv_register_write(uint32_t *reg, uint32_t regno)
     } while(target.dm.abstractcs.busy);
 }
 
+/*
+ * Wait for the running abstract command, clear cmderr and return it.
+ */
+static uint32_t rv_abstract_wait(void)
+{
+    uint32_t cmderr;
+
+    do {
+        rv_dmi_read(RV_DM_ABSTRACT_CONTROL_AND_STATUS, &target.dm.abstractcs.value);
+    } while (target.dm.abstractcs.busy && (result == RV_DMI_RESULT_DONE));
+
+    cmderr = target.dm.abstractcs.cmderr;
+    if (cmderr) {
+        target.dm.abstractcs.value = 0;
+        target.dm.abstractcs.cmderr = 0x7;
+        rv_dmi_write(RV_DM_ABSTRACT_CONTROL_AND_STATUS, target.dm.abstractcs.value);
+    }
+    return cmderr;
+}
+
+static void rv_memory_set_address(uint64_t addr)
+{
+    if (MXL_RV32 == target.misa.mxl) {
+        target.dm.data[1] = addr;
+        rv_dmi_write(RV_DM_ABSTRACT_DATA1, target.dm.data[1]);
+    } else if (MXL_RV64 == target.misa.mxl) {
+        target.dm.data[2] = addr;
+        rv_dmi_write(RV_DM_ABSTRACT_DATA2, target.dm.data[2]);
+        target.dm.data[3] = addr >> 32;
+        rv_dmi_write(RV_DM_ABSTRACT_DATA3, target.dm.data[3]);
+    }
+}
+
+static uint32_t rv_memory_get(const uint8_t *mem, uint32_t i, uint32_t aamsize)
+{
+    switch(aamsize) {
+        case RV_AAMSIZE_8BITS:
+            return ((const uint8_t*)mem)[i];
+        case RV_AAMSIZE_16BITS:
+            return ((const uint16_t*)mem)[i];
+        case RV_AAMSIZE_32BITS:
+            return ((const uint32_t*)mem)[i];
+        default:
+            return 0;
+    }
+}
+
+static void rv_memory_put(uint8_t *mem, uint32_t i, uint32_t aamsize, uint32_t data)
+{
+    switch(aamsize) {
+        case RV_AAMSIZE_8BITS:
+            ((uint8_t*)mem)[i] = data & 0xff;
+            break;
+        case RV_AAMSIZE_16BITS:
+            ((uint16_t*)mem)[i] = data & 0xffff;
+            break;
+        case RV_AAMSIZE_32BITS:
+            ((uint32_t*)mem)[i] = data;
+            break;
+        default:
+            break;
+    }
+}
+
+static void rv_memory_set_autoexec(uint32_t autoexecdata)
+{
+    target.dm.abstractauto.value = 0;
+    target.dm.abstractauto.autoexecdata = autoexecdata;
+    rv_dmi_write(RV_DM_ABSTRACT_COMMAND_AUTOEXEC, target.dm.abstractauto.value);
+}
+
+/*
+ * Bulk read: the first element is fetched by an explicit command with
+ * aampostincrement, then abstractauto re-executes it on every DATA0 read,
+ * so each further element costs a single (pipelined) DMI read.
+ *
+ * Returns false if anything went wrong, the caller then redoes the whole
+ * range word by word, which also reports the error.
+ */
+static bool rv_memory_read_bulk(uint8_t *mem, uint64_t addr, uint32_t len, uint32_t aamsize)
+{
+    uint32_t i;
+    bool ok = true;
+
+    if (len < 2) {
+        return false;
+    }
+
+    rv_memory_set_address(addr);
+
+    target.dm.command.value = 0;
+    target.dm.command.mem.cmdtype = RV_DM_ABSTRACT_CMD_ACCESS_MEM;
+    target.dm.command.mem.aamsize = aamsize;
+    target.dm.command.mem.aampostincrement = 1;
+    rv_dmi_write(RV_DM_ABSTRACT_COMMAND, target.dm.command.value);
+    if (rv_abstract_wait()) {
+        return false;
+    }
+
+    rv_memory_set_autoexec(1);
+
+    /* elements 0 .. len - 2, each read fetches the next one */
+    rv_dmi_exec(RV_DMI_OP_READ, RV_DM_ABSTRACT_DATA0, 0x00);
+    ok = (result == RV_DMI_RESULT_DONE);
+    for (i = 1; ok && (i < len - 1); i++) {
+        rv_dmi_exec(RV_DMI_OP_READ, RV_DM_ABSTRACT_DATA0, 0x00);
+        ok = (result == RV_DMI_RESULT_DONE);
+        rv_memory_put(mem, i - 1, aamsize, target.dmi.data);
+    }
+    if (ok) {
+        rv_dmi_exec(RV_DMI_OP_READ, RV_DM_ABSTRACT_CONTROL_AND_STATUS, 0x00);
+        ok = (result == RV_DMI_RESULT_DONE);
+        rv_memory_put(mem, len - 2, aamsize, target.dmi.data);
+    }
+
+    /* a DATA0 access while the command was still busy shows up here */
+    if (rv_abstract_wait()) {
+        ok = false;
+    }
+    rv_memory_set_autoexec(0);
+
+    /* last element, without fetching past the end of the range */
+    if (ok) {
+        rv_dmi_read(RV_DM_ABSTRACT_DATA0, &target.dm.data[0]);
+        ok = (result == RV_DMI_RESULT_DONE);
+        rv_memory_put(mem, len - 1, aamsize, target.dm.data[0]);
+    } else {
+        rv_dmi_flush();
+        target.dmi_busy_delay += (target.dmi_busy_delay >> 1) + 1;
+    }
+
+    return ok;
+}
+
+/*
+ * Bulk write: same as rv_memory_read_bulk(), every DATA0 write stores one
+ * element and advances the address.
+ */
+static bool rv_memory_write_bulk(const uint8_t *mem, uint64_t addr, uint32_t len, uint32_t aamsize)
+{
+    uint32_t i;
+    bool ok = true;
+
+    if (len < 2) {
+        return false;
+    }
+
+    rv_memory_set_address(addr);
+    target.dm.data[0] = rv_memory_get(mem, 0, aamsize);
+    rv_dmi_write(RV_DM_ABSTRACT_DATA0, target.dm.data[0]);
+
+    target.dm.command.value = 0;
+    target.dm.command.mem.cmdtype = RV_DM_ABSTRACT_CMD_ACCESS_MEM;
+    target.dm.command.mem.aamsize = aamsize;
+    target.dm.command.mem.aampostincrement = 1;
+    target.dm.command.mem.write = 1;
+    rv_dmi_write(RV_DM_ABSTRACT_COMMAND, target.dm.command.value);
+    if (rv_abstract_wait()) {
+        return false;
+    }
+
+    rv_memory_set_autoexec(1);
+
+    for (i = 1; ok && (i < len); i++) {
+        target.dm.data[0] = rv_memory_get(mem, i, aamsize);
+        rv_dmi_write(RV_DM_ABSTRACT_DATA0, target.dm.data[0]);
+        ok = (result == RV_DMI_RESULT_DONE);
+    }
+
+    if (rv_abstract_wait()) {
+        ok = false;
+    }
+    rv_memory_set_autoexec(0);
+    rv_dmi_flush();
+
+    if (!ok) {
+        target.dmi_busy_delay += (target.dmi_busy_delay >> 1) + 1;
+    }
+
+    return ok;
+}
+
 static void rv_memory_read(uint8_t *mem, uint64_t addr, uint32_t len, uint32_t aamsize)
 {
     uint32_t i;
@@ -296,6 +602,12 @@ static void rv_memory_read(uint8_t *mem, uint64_t addr, uint32_t len, uint32_t a
 
     err_flag = false;
 
+    if ((len > RV_TARGET_CONFIG_MEMORY_BULK_THRESHOLD) && target.abstractauto && target.aampostincrement) {
+        if (rv_memory_read_bulk(mem, addr, len, aamsize)) {
+            return;
+        }
+    }
+
     for (i = 0; i < len; i++) {
         if (MXL_RV32 == target.misa.mxl) {
             target.dm.data[1] = addr + (i << aamsize);
@@ -352,6 +664,12 @@ static void rv_memory_write(const uint8_t* mem, uint64_t addr, uint32_t len, uin
 
     err_flag = false;
 
+    if ((len > RV_TARGET_CONFIG_MEMORY_BULK_THRESHOLD) && target.abstractauto && target.aampostincrement) {
+        if (rv_memory_write_bulk(mem, addr, len, aamsize)) {
+            return;
+        }
+    }
+
     for (i = 0; i < len; i++) {
         if (MXL_RV32 == target.misa.mxl) {
             target.dm.data[1] = addr + (i << aamsize);
@@ -398,6 +716,145 @@ static void rv_memory_write(const uint8_t* mem, uint64_t addr, uint32_t len, uin
     }
 }
 
+/*
+ * System bus access, independent of the hart state.
+ *
+ * Pick the widest access the DM supports that fits the alignment of the
+ * range, returns false if there is none.
+ */
+static bool rv_sba_access_size(uint64_t addr, uint32_t len, uint32_t *sbaccess)
+{
+    int32_t i;
+
+    for (i = RV_AAMSIZE_64BITS; i >= RV_AAMSIZE_8BITS; i--) {
+        if ((target.sba_access_mask & (1 << i)) &&
+            (((addr | len) & ((1 << i) - 1)) == 0)) {
+            *sbaccess = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void rv_sba_set_address(uint64_t addr)
+{
+    if (target.sba_asize > 32) {
+        rv_dmi_write(RV_DM_SYSTEM_BUS_ADDRESS1, addr >> 32);
+    }
+    rv_dmi_write(RV_DM_SYSTEM_BUS_ADDRESS0, addr);
+}
+
+/*
+ * Wait for the bus to go idle and check sberror/sbbusyerror. Both are
+ * write-1-to-clear, on error they are cleared and the DMI delay is grown
+ * since sbbusyerror means sbdata was accessed too early.
+ */
+static bool rv_sba_wait(void)
+{
+    do {
+        rv_dmi_read(RV_DM_ACCESS_CONTROL_AND_STATUS, &target.dm.sbcs.value);
+    } while (target.dm.sbcs.sbbusy && (result == RV_DMI_RESULT_DONE));
+
+    if (result != RV_DMI_RESULT_DONE) {
+        return false;
+    }
+    if (target.dm.sbcs.sberror || target.dm.sbcs.sbbusyerror) {
+        target.dm.sbcs.value = 0;
+        target.dm.sbcs.sberror = 0x7;
+        target.dm.sbcs.sbbusyerror = 1;
+        rv_dmi_write(RV_DM_ACCESS_CONTROL_AND_STATUS, target.dm.sbcs.value);
+        rv_dmi_flush();
+        target.dmi_busy_delay += (target.dmi_busy_delay >> 1) + 1;
+        return false;
+    }
+    return true;
+}
+
+static bool rv_sba_read(uint8_t *mem, uint64_t addr, uint32_t len)
+{
+    uint32_t i, num, sbaccess;
+    uint32_t data[2][2];
+
+    if (!rv_sba_access_size(addr, len, &sbaccess)) {
+        return false;
+    }
+    num = len >> sbaccess;
+
+    /*
+     * sbreadonaddr starts the first read, sbreadondata starts the next one
+     * on every sbdata0 read. It is turned off before the last element so
+     * nothing is read past the end of the range; sbcs is only written once
+     * the bus went idle, that read may still be running. Results come back
+     * one scan late, so elements alternate between two buffers.
+     */
+    target.dm.sbcs.value = 0;
+    target.dm.sbcs.sbaccess = sbaccess;
+    target.dm.sbcs.sbautoincrement = 1;
+    target.dm.sbcs.sbreadonaddr = 1;
+    target.dm.sbcs.sbreadondata = (num > 1);
+    target.dm.sbcs.sberror = 0x7;
+    target.dm.sbcs.sbbusyerror = 1;
+    rv_dmi_write(RV_DM_ACCESS_CONTROL_AND_STATUS, target.dm.sbcs.value);
+    rv_sba_set_address(addr);
+
+    memset(data, 0, sizeof(data));
+    for (i = 0; i < num; i++) {
+        if ((i == num - 1) && (num > 1)) {
+            rv_dmi_pipe(RV_DMI_OP_NOP, 0x00, 0x00, NULL);
+            if (!rv_sba_wait()) {
+                return false;
+            }
+            target.dm.sbcs.sbreadondata = 0;
+            target.dm.sbcs.sberror = 0;
+            target.dm.sbcs.sbbusyerror = 0;
+            rv_dmi_pipe(RV_DMI_OP_WRITE, RV_DM_ACCESS_CONTROL_AND_STATUS, target.dm.sbcs.value, NULL);
+        }
+        if (sbaccess == RV_AAMSIZE_64BITS) {
+            rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_SYSTEM_BUS_DATA1, 0x00, &data[i & 1][1]);
+        }
+        rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_SYSTEM_BUS_DATA0, 0x00, &data[i & 1][0]);
+        if (i > 0) {
+            memcpy(mem + ((i - 1) << sbaccess), data[(i - 1) & 1], 1 << sbaccess);
+        }
+    }
+    rv_dmi_pipe(RV_DMI_OP_NOP, 0x00, 0x00, NULL);
+    memcpy(mem + ((num - 1) << sbaccess), data[(num - 1) & 1], 1 << sbaccess);
+
+    return rv_sba_wait();
+}
+
+static bool rv_sba_write(const uint8_t *mem, uint64_t addr, uint32_t len)
+{
+    uint32_t i, num, sbaccess;
+    uint32_t data[2];
+
+    if (!rv_sba_access_size(addr, len, &sbaccess)) {
+        return false;
+    }
+    num = len >> sbaccess;
+
+    target.dm.sbcs.value = 0;
+    target.dm.sbcs.sbaccess = sbaccess;
+    target.dm.sbcs.sbautoincrement = 1;
+    target.dm.sbcs.sberror = 0x7;
+    target.dm.sbcs.sbbusyerror = 1;
+    rv_dmi_write(RV_DM_ACCESS_CONTROL_AND_STATUS, target.dm.sbcs.value);
+    rv_sba_set_address(addr);
+
+    /* every sbdata0 write starts one bus write */
+    for (i = 0; i < num; i++) {
+        data[1] = 0;
+        memcpy(data, mem + (i << sbaccess), 1 << sbaccess);
+        if (sbaccess == RV_AAMSIZE_64BITS) {
+            rv_dmi_write(RV_DM_SYSTEM_BUS_DATA1, data[1]);
+        }
+        rv_dmi_write(RV_DM_SYSTEM_BUS_DATA0, data[0]);
+    }
+    rv_dmi_flush();
+
+    return rv_sba_wait();
+}
+
 void rv_program_exec(uint32_t* inst, uint32_t num)
 {
     for (int i = 0; i < num; i++) {
@@ -423,13 +880,20 @@ void rv_program_exec(uint32_t* inst, uint32_t num)
     } while(target.dm.abstractcs.busy);
 }
 
+static void rv_core_register_read(void *reg, uint32_t regno);
+static void rv_core_register_write(void *reg, uint32_t regno);
+static void rv_target_commit_breakpoints(void);
+static void rv_software_breakpoint_mask(uint8_t* mem, uint64_t addr, uint32_t len, bool write);
+static void rv_trigger_discover(void);
+static void rv_hardware_breakpoint_clear(uint32_t i);
+
 static void rv_register_write_buf(void *reg, uint32_t regno)
 {
     uint32_t inst[2];
     uint32_t inst_num;
     uint64_t save_fp, save_s1;
 
-    rv_target_read_register(&save_fp, RV_REG_FP);
+    rv_core_register_read(&save_fp, RV_REG_FP);
 
     if (regno >= RV_REG_FT0 && regno <= RV_REG_FT11) {
         if (target.misa.d && (target.misa.mxl == MXL_RV32)) {// RV32 D
@@ -438,40 +902,40 @@ static void rv_register_write_buf(void *reg, uint32_t regno)
             scratch_addr = target.dm.hartinfo.dataaddr;
             inst[0] = fld(regno - RV_REG_FT0, RV_REG_FP, 0);
             inst_num = 1;
-            rv_target_write_register(&scratch_addr, RV_REG_FP);
+            rv_core_register_write(&scratch_addr, RV_REG_FP);
             rv_memory_write(reg, scratch_addr, 8, RV_AAMSIZE_32BITS);
             rv_program_exec(inst, inst_num);
         } else if (target.misa.d) {// RV64 D
             inst[0] = fmv_d_x(regno - RV_REG_FT0, RV_REG_FP);
             inst_num = 1;
-            rv_target_write_register(reg, RV_REG_FP);
+            rv_core_register_write(reg, RV_REG_FP);
             rv_program_exec(inst, inst_num);
         } else {// RV32/RV64 F
             inst[0] = fmv_w_x(regno - RV_REG_FT0, RV_REG_FP);
             inst_num = 1;
-            rv_target_write_register(reg, RV_REG_FP);
+            rv_core_register_write(reg, RV_REG_FP);
             rv_program_exec(inst, inst_num);
         }
     } else if (regno == RV_REG_VL) {
-        rv_target_read_register(&save_s1, RV_REG_S1);
+        rv_core_register_read(&save_s1, RV_REG_S1);
         inst[0] = csrr(RV_REG_S1, RV_REG_VTYPE - RV_REG_CSR0);
         inst[1] = vsetvl(RV_REG_ZERO, RV_REG_FP, RV_REG_S1);
         inst_num = 2;
-        rv_target_write_register(reg, RV_REG_FP);
+        rv_core_register_write(reg, RV_REG_FP);
         rv_program_exec(inst, inst_num);
-        rv_target_write_register(&save_s1, RV_REG_S1);
+        rv_core_register_write(&save_s1, RV_REG_S1);
     } else if (regno == RV_REG_VTYPE) {
-        rv_target_read_register(&save_s1, RV_REG_S1);
+        rv_core_register_read(&save_s1, RV_REG_S1);
         inst[0] = csrr(RV_REG_S1, RV_REG_VL - RV_REG_CSR0);
         inst[1] = vsetvl(RV_REG_ZERO, RV_REG_S1, RV_REG_FP);
         inst_num = 2;
-        rv_target_write_register(reg, RV_REG_FP);
+        rv_core_register_write(reg, RV_REG_FP);
         rv_program_exec(inst, inst_num);
-        rv_target_write_register(&save_s1, RV_REG_S1);
+        rv_core_register_write(&save_s1, RV_REG_S1);
     } else if (regno >= RV_REG_CSR0 && regno <= (4095 + RV_REG_CSR0)) {
         inst[0] = csrrw(RV_REG_ZERO, RV_REG_FP, regno - RV_REG_CSR0);
         inst_num = 1;
-        rv_target_write_register(reg, RV_REG_FP);
+        rv_core_register_write(reg, RV_REG_FP);
         rv_program_exec(inst, inst_num);
     } else if (RV_REG_V0 < regno < RV_REG_V31) {
         uint64_t xlen, debug_vl, encoded_vsew;
@@ -488,15 +952,15 @@ static void rv_register_write_buf(void *reg, uint32_t regno)
         inst_num = 1;
         for (int i = 0; i < debug_vl; i++) {
             if (MXL_RV32 == target.misa.mxl) {
-                rv_target_write_register((uint32_t*)reg + i, RV_REG_FP);
+                rv_core_register_write((uint32_t*)reg + i, RV_REG_FP);
             } else if (MXL_RV64 == target.misa.mxl) {
-                rv_target_write_register((uint64_t*)reg + i, RV_REG_FP);
+                rv_core_register_write((uint64_t*)reg + i, RV_REG_FP);
             }
             rv_program_exec(inst, inst_num);
         }
     }
 
-    rv_target_write_register(&save_fp, RV_REG_FP);
+    rv_core_register_write(&save_fp, RV_REG_FP);
 }
 
 static void rv_register_read_buf(void *reg, uint32_t regno)
@@ -505,7 +969,7 @@ static void rv_register_read_buf(void *reg, uint32_t regno)
     uint32_t inst_num;
     uint64_t save_fp;
 
-    rv_target_read_register(&save_fp, RV_REG_FP);
+    rv_core_register_read(&save_fp, RV_REG_FP);
 
     if (regno >= RV_REG_FT0 && regno <= RV_REG_FT11) {
         if (target.misa.d && (target.misa.mxl == MXL_RV32)) {// RV32 D
@@ -514,25 +978,25 @@ static void rv_register_read_buf(void *reg, uint32_t regno)
             scratch_addr = target.dm.hartinfo.dataaddr;
             inst[0] = fsd(regno - RV_REG_FT0, RV_REG_FP, 0);
             inst_num = 1;
-            rv_target_write_register(&scratch_addr, RV_REG_FP);
+            rv_core_register_write(&scratch_addr, RV_REG_FP);
             rv_program_exec(inst, inst_num);
             rv_memory_read(reg, scratch_addr, 8, RV_AAMSIZE_32BITS);
         } else if (target.misa.d) {// RV64 D
             inst[0] = fmv_x_d(RV_REG_FP, regno - RV_REG_FT0);
             inst_num = 1;
             rv_program_exec(inst, inst_num);
-            rv_target_read_register(reg, RV_REG_FP);
+            rv_core_register_read(reg, RV_REG_FP);
         } else {// RV32/RV64 F
             inst[0] = fmv_x_w(RV_REG_FP, regno - RV_REG_FT0);
             inst_num = 1;
             rv_program_exec(inst, inst_num);
-            rv_target_read_register(reg, RV_REG_FP);
+            rv_core_register_read(reg, RV_REG_FP);
         }
     } else if (regno >= RV_REG_CSR0 && regno <= (4095 + RV_REG_CSR0)) {
         inst[0] = csrrs(RV_REG_FP, RV_REG_ZERO, regno - RV_REG_CSR0);
         inst_num = 1;
         rv_program_exec(inst, inst_num);
-        rv_target_read_register(reg, RV_REG_FP);
+        rv_core_register_read(reg, RV_REG_FP);
     } else if (RV_REG_V0 < regno < RV_REG_V31) {
         uint64_t xlen, debug_vl, encoded_vsew;
         xlen = target.misa.mxl * 32;
@@ -550,14 +1014,14 @@ static void rv_register_read_buf(void *reg, uint32_t regno)
         for (int i = 0; i < debug_vl; i++) {
             rv_program_exec(inst, inst_num);
             if (MXL_RV32 == target.misa.mxl) {
-                rv_target_read_register((uint32_t*)reg + i, RV_REG_FP);
+                rv_core_register_read((uint32_t*)reg + i, RV_REG_FP);
             } else if (MXL_RV64 == target.misa.mxl) {
-                rv_target_read_register((uint64_t*)reg + i, RV_REG_FP);
+                rv_core_register_read((uint64_t*)reg + i, RV_REG_FP);
             }
         }
     }
 
-    rv_target_write_register(&save_fp, RV_REG_FP);
+    rv_core_register_write(&save_fp, RV_REG_FP);
 }
 
 static void rv_prep_for_vector_access()
@@ -666,6 +1130,75 @@ static void rv_parse_watchpoint_inst(uint32_t inst, uint32_t* regno, uint32_t* o
     *offset = offset_s;
 }
 
+static int32_t rv_reg_cache_index(uint32_t regno)
+{
+    if (regno > RV_REG_ZERO && regno <= RV_REG_FT11) {
+        return regno;
+    } else if (regno == RV_REG_DPC) {
+        return RV_REG_PC;
+    } else if (regno == RV_REG_DCSR) {
+        return RV_REG_CACHE_DCSR;
+    } else if (regno == RV_REG_MSTATUS) {
+        return RV_REG_CACHE_MSTATUS;
+    } else if (regno == RV_REG_TSELECT) {
+        return RV_REG_CACHE_TSELECT;
+    }
+    return -1;
+}
+
+static uint32_t rv_reg_cache_regno(uint32_t index)
+{
+    if (index == RV_REG_PC) {
+        return RV_REG_DPC;
+    } else if (index == RV_REG_CACHE_DCSR) {
+        return RV_REG_DCSR;
+    } else if (index == RV_REG_CACHE_MSTATUS) {
+        return RV_REG_MSTATUS;
+    } else if (index == RV_REG_CACHE_TSELECT) {
+        return RV_REG_TSELECT;
+    }
+    return index;
+}
+
+static uint32_t rv_reg_cache_size(uint32_t index)
+{
+    if (index == RV_REG_CACHE_DCSR) {
+        return 4;
+    } else if ((index >= RV_REG_FT0) && (index <= RV_REG_FT11) && target.misa.d) {
+        return 8;
+    }
+    return (MXL_RV64 == target.misa.mxl) ? 8 : 4;
+}
+
+static void rv_reg_cache_invalidate(void)
+{
+    memset(target.reg_cache_state, 0, sizeof(target.reg_cache_state));
+}
+
+static void rv_reg_cache_writeback(uint32_t index)
+{
+    if (target.reg_cache_state[index] & RV_REG_CACHE_DIRTY) {
+        rv_core_register_write(&target.reg_cache[index], rv_reg_cache_regno(index));
+        target.reg_cache_state[index] &= ~RV_REG_CACHE_DIRTY;
+    }
+}
+
+/*
+ * Write back dirty entries: FPRs and CSRs first, their progbuf fallback
+ * uses GPRs as scratch, then the GPRs themselves.
+ */
+static void rv_reg_cache_flush(void)
+{
+    uint32_t i;
+
+    for (i = RV_REG_FT0; i < RV_REG_CACHE_NUM; i++) {
+        rv_reg_cache_writeback(i);
+    }
+    for (i = RV_REG_PC; i > RV_REG_ZERO; i--) {
+        rv_reg_cache_writeback(i);
+    }
+}
+
 void rv_target_get_error(const char **str, uint32_t* pc)
 {
     *str = err_msg;
@@ -678,12 +1211,17 @@ void rv_target_init(void)
 
     for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
         hardware_breakpoints[i].type = rv_target_breakpoint_type_unused;
+        hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
     }
 
-    for(i = 0; i < RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM; i++) {
-        software_breakpoints[i].type = rv_target_breakpoint_type_unused;
+    for(i = 0; i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM; i++) {
+        software_breakpoints[i].state = RV_SOFTWARE_BREAKPOINT_FREE;
+        software_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
     }
+    software_breakpoint_num = 0;
 
+    target.dcsr_step = RV_DCSR_STEP_UNKNOWN;
+    target.icount_active = false;
     err_flag = false;
     err_pc = 0;
     err_msg = "no error";
@@ -693,6 +1231,13 @@ void rv_target_init(void)
     rv_target_ir_pre = 0;
     target.misa.value = 0;
     target.vlenb = 0;
+    target.abstractauto = false;
+    target.aampostincrement = false;
+    target.sba = false;
+    target.dmi_read_out = NULL;
+    rv_reg_cache_invalidate();
+    target.dmi_pending = false;
+    target.dmi_busy_delay = 0;
 
     rv_tap_init();
 }
@@ -712,6 +1257,11 @@ uint32_t rv_target_mxl(void)
     return target.misa.mxl;
 }
 
+bool rv_target_sba_supported(void)
+{
+    return target.sba;
+}
+
 uint64_t rv_target_vlenb(void)
 {
     return target.vlenb;
@@ -759,6 +1309,7 @@ void rv_target_init_post(rv_target_error_t *err)
     target.dm.dmcontrol.value = 0;
     target.dm.dmcontrol.dmactive = 1;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
     if (result != RV_DMI_RESULT_DONE) {
         *err = rv_target_error_debug_module;
         return;
@@ -773,12 +1324,28 @@ void rv_target_init_post(rv_target_error_t *err)
         return;
     }
 
+#if RV_TARGET_CONFIG_SYSTEM_BUS_ACCESS
+    /*
+     * probe system bus access
+     */
+    rv_dmi_read(RV_DM_ACCESS_CONTROL_AND_STATUS, &target.dm.sbcs.value);
+    if ((result == RV_DMI_RESULT_DONE) && (target.dm.sbcs.sbversion == 1) &&
+        (target.dm.sbcs.sbasize != 0) && (target.dm.sbcs.sbasize <= 64)) {
+        target.sba_access_mask = target.dm.sbcs.value & 0x1f;
+        target.sba_asize = target.dm.sbcs.sbasize;
+        target.sba = (target.sba_access_mask != 0);
+    }
+#endif
+
     return;
 }
 
 void rv_target_init_after_halted(rv_target_error_t *err)
 {
-    uint32_t i;
+    uint64_t addr;
+
+    rv_reg_cache_invalidate();
+    target.dcsr_step = RV_DCSR_STEP_UNKNOWN;
 
     /* get misa */
     rv_misa_rv32_t misa32;
@@ -828,16 +1395,44 @@ void rv_target_init_after_halted(rv_target_error_t *err)
     rv_target_write_register(&dcsr.value, RV_REG_DCSR);
 
     /*
-     * clear all hardware breakpoints
+     * find and clear all hardware breakpoints
      */
-    for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
-        rv_target_write_register(&i, RV_REG_TSELECT);
-        rv_target_write_register(&zero, RV_REG_TDATA1);
+    rv_trigger_discover();
+
+    /*
+     * probe abstractauto and aampostincrement for bulk memory access
+     */
+    rv_memory_set_autoexec(1);
+    rv_dmi_read(RV_DM_ABSTRACT_COMMAND_AUTOEXEC, &target.dm.abstractauto.value);
+    target.abstractauto = (result == RV_DMI_RESULT_DONE) && (target.dm.abstractauto.autoexecdata & 1);
+    rv_memory_set_autoexec(0);
+
+    rv_target_read_register(&dpc, RV_REG_DPC);
+    addr = dpc & ~0x3ULL;
+    rv_memory_set_address(addr);
+    target.dm.command.value = 0;
+    target.dm.command.mem.cmdtype = RV_DM_ABSTRACT_CMD_ACCESS_MEM;
+    target.dm.command.mem.aamsize = RV_AAMSIZE_32BITS;
+    target.dm.command.mem.aampostincrement = 1;
+    rv_dmi_write(RV_DM_ABSTRACT_COMMAND, target.dm.command.value);
+    if (rv_abstract_wait()) {
+        target.aampostincrement = false;
+    } else {
+        if (MXL_RV32 == target.misa.mxl) {
+            rv_dmi_read(RV_DM_ABSTRACT_DATA1, &target.dm.data[1]);
+            target.aampostincrement = (target.dm.data[1] == (uint32_t)(addr + 4));
+        } else {
+            rv_dmi_read(RV_DM_ABSTRACT_DATA2, &target.dm.data[2]);
+            target.aampostincrement = (target.dm.data[2] == (uint32_t)(addr + 4));
+        }
     }
 }
 
 void rv_target_fini_pre(void)
 {
+    /* GDB took its breakpoints out before detaching */
+    rv_target_commit_breakpoints();
+
     /*
      * ebreak instructions in X-mode behave as described in the Privileged Spec.
      */
@@ -846,12 +1441,15 @@ void rv_target_fini_pre(void)
     dcsr.ebreaks = 0;
     dcsr.ebreaku = 0;
     rv_target_write_register(&dcsr.value, RV_REG_DCSR);
+    rv_reg_cache_flush();
+    rv_reg_cache_invalidate();
 
     /*
      * Disable debug module
      */
     target.dm.dmcontrol.value = 0;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 }
 
 void rv_target_read_core_registers(void *regs)
@@ -890,13 +1488,13 @@ void rv_target_write_core_registers(void *regs)
     }
 }
 
-void rv_target_read_register(void *reg, uint32_t regno)
+static void rv_core_register_read(void *reg, uint32_t regno)
 {
     rv_prep_for_register_access(regno);
     if (regno >= RV_REG_ZERO && regno < RV_REG_PC) {
         rv_register_read((uint32_t*)reg, 0x1000 + regno - RV_REG_ZERO);
     } else if (regno == RV_REG_PC) {
-        rv_target_read_register(reg, RV_REG_DPC);
+        rv_core_register_read(reg, RV_REG_DPC);
     } else if (regno >= RV_REG_FT0 && regno <= RV_REG_FT11) {
         rv_register_read((uint32_t*)reg, 0x1020 + regno - RV_REG_FT0);
         /* abstract fail try progbuf */
@@ -922,13 +1520,13 @@ void rv_target_read_register(void *reg, uint32_t regno)
     rv_cleanup_after_register_access(regno);
 }
 
-void rv_target_write_register(void *reg, uint32_t regno)
+static void rv_core_register_write(void *reg, uint32_t regno)
 {
     rv_prep_for_register_access(regno);
     if (regno >= RV_REG_ZERO && regno < RV_REG_PC) {
         rv_register_write((uint32_t*)reg, 0x1000 + regno - RV_REG_ZERO);
     } else if (regno == RV_REG_PC) {
-        rv_target_write_register(reg, RV_REG_DPC);
+        rv_core_register_write(reg, RV_REG_DPC);
     } else if (regno >= RV_REG_FT0 && regno <= RV_REG_FT11) {
         rv_register_write((uint32_t*)reg, 0x1020 + regno - RV_REG_FT0);
         /* abstract fail try progbuf */
@@ -953,15 +1551,175 @@ void rv_target_write_register(void *reg, uint32_t regno)
     rv_cleanup_after_register_access(regno);
 }
 
-void rv_target_read_memory(uint8_t* mem, uint64_t addr, uint32_t len)
+void rv_target_read_register(void *reg, uint32_t regno)
 {
-    if (((uint32_t)mem & 3) == 0 && (addr & 3) == 0 && (len & 3) == 0) {
-        rv_memory_read(mem, addr, len / 4, RV_AAMSIZE_32BITS);
-    } else if (((uint32_t)mem & 1) == 0 && (addr & 1) == 0 && (len & 1) == 0) {
-        rv_memory_read(mem, addr, len / 2, RV_AAMSIZE_16BITS);
-    } else {
-        rv_memory_read(mem, addr, len, RV_AAMSIZE_8BITS);
-    }
+    int32_t index;
+
+    index = rv_reg_cache_index(regno);
+    if (index < 0) {
+        rv_core_register_read(reg, regno);
+        return;
+    }
+
+    if (!(target.reg_cache_state[index] & RV_REG_CACHE_VALID)) {
+        target.reg_cache[index] = 0;
+        rv_core_register_read(&target.reg_cache[index], regno);
+        if (err_flag) {
+            memcpy(reg, &target.reg_cache[index], rv_reg_cache_size(index));
+            return;
+        }
+        target.reg_cache_state[index] = RV_REG_CACHE_VALID;
+    }
+    memcpy(reg, &target.reg_cache[index], rv_reg_cache_size(index));
+}
+
+/*
+ * GPRs, PC, FPRs and dcsr are written back at resume/step. mstatus and
+ * tselect change how other registers are accessed, so they are written
+ * through and only re-read on the next access.
+ */
+void rv_target_write_register(void *reg, uint32_t regno)
+{
+    int32_t index;
+    uint32_t size;
+
+    index = rv_reg_cache_index(regno);
+    if ((index == RV_REG_CACHE_MSTATUS) || (index == RV_REG_CACHE_TSELECT)) {
+        target.reg_cache_state[index] = 0;
+    }
+    if ((index < 0) || (index == RV_REG_CACHE_MSTATUS) || (index == RV_REG_CACHE_TSELECT)) {
+        rv_core_register_write(reg, regno);
+        return;
+    }
+    if (index == RV_REG_CACHE_DCSR) {
+        target.dcsr_step = ((rv_dcsr_t*)reg)->step;
+    }
+
+    size = rv_reg_cache_size(index);
+    if ((target.reg_cache_state[index] & RV_REG_CACHE_VALID) &&
+        (0 == memcmp(&target.reg_cache[index], reg, size))) {
+        return;
+    }
+    target.reg_cache[index] = 0;
+    memcpy(&target.reg_cache[index], reg, size);
+    target.reg_cache_state[index] = RV_REG_CACHE_VALID | RV_REG_CACHE_DIRTY;
+}
+
+/*
+ * Read a set of registers into a uint64_t array. GPRs and the PC that are
+ * not cached yet are fetched in one pipelined DMI sequence: each command is
+ * followed by abstractcs reads until it is done, then by its data reads,
+ * which come back with the scan of the next command. Registers whose
+ * command or scans failed are read again one by one.
+ */
+void rv_target_read_registers(uint64_t *regs, const uint32_t *regno, uint32_t num)
+{
+    uint32_t i, n, prev;
+    int32_t index;
+    bool batch[RV_TARGET_BATCH_REG_NUM];
+    uint32_t cs[RV_TARGET_BATCH_REG_NUM];
+    uint32_t data[RV_TARGET_BATCH_REG_NUM][2];
+    rv_abstract_control_and_status_t abstractcs;
+
+    while (num) {
+        n = (num > RV_TARGET_BATCH_REG_NUM) ? RV_TARGET_BATCH_REG_NUM : num;
+
+        /* the register whose last data read is still in flight, n for none */
+        prev = n;
+        for (i = 0; i < n; i++) {
+            index = rv_reg_cache_index(regno[i]);
+            batch[i] = (index > RV_REG_ZERO) && (index <= RV_REG_PC) &&
+                        !(target.reg_cache_state[index] & RV_REG_CACHE_VALID);
+            if (!batch[i]) {
+                continue;
+            }
+            target.dm.command.value = 0;
+            target.dm.command.reg.cmdtype = RV_DM_ABSTRACT_CMD_ACCESS_REG;
+            target.dm.command.reg.aarsize = (MXL_RV64 == target.misa.mxl) ? 3 : 2;
+            target.dm.command.reg.transfer = 1;
+            if (index == RV_REG_PC) {
+                target.dm.command.reg.regno = RV_REG_DPC - RV_REG_CSR0;
+            } else {
+                target.dm.command.reg.regno = 0x1000 + index - RV_REG_ZERO;
+            }
+            data[i][1] = 0;
+            rv_dmi_pipe(RV_DMI_OP_WRITE, RV_DM_ABSTRACT_COMMAND, target.dm.command.value, NULL);
+            if ((prev < n) && (result != RV_DMI_RESULT_DONE)) {
+                batch[prev] = false;
+            }
+            prev = n;
+
+            /* a command issued while one is busy fails, wait for this one */
+            rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_ABSTRACT_CONTROL_AND_STATUS, 0x00, &cs[i]);
+            abstractcs.value = 0;
+            abstractcs.busy = 1;
+            while (abstractcs.busy && (result == RV_DMI_RESULT_DONE)) {
+                rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_ABSTRACT_CONTROL_AND_STATUS, 0x00, &cs[i]);
+                abstractcs.value = cs[i];
+            }
+            if ((result != RV_DMI_RESULT_DONE) || abstractcs.cmderr) {
+                /* clears cmderr, so the next command runs */
+                batch[i] = false;
+                rv_dmi_pipe(RV_DMI_OP_NOP, 0x00, 0x00, NULL);
+                rv_abstract_wait();
+                continue;
+            }
+
+            rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_ABSTRACT_DATA0, 0x00, &data[i][0]);
+            if (MXL_RV64 == target.misa.mxl) {
+                rv_dmi_pipe(RV_DMI_OP_READ, RV_DM_ABSTRACT_DATA1, 0x00, &data[i][1]);
+                if (result != RV_DMI_RESULT_DONE) {
+                    batch[i] = false;
+                }
+            }
+            prev = i;
+        }
+        rv_dmi_pipe(RV_DMI_OP_NOP, 0x00, 0x00, NULL);
+        if ((prev < n) && (result != RV_DMI_RESULT_DONE)) {
+            batch[prev] = false;
+        }
+        rv_abstract_wait();
+
+        for (i = 0; i < n; i++) {
+            if (batch[i]) {
+                index = rv_reg_cache_index(regno[i]);
+                target.reg_cache[index] = ((uint64_t)data[i][1] << 32) | data[i][0];
+                target.reg_cache_state[index] = RV_REG_CACHE_VALID;
+            }
+            regs[i] = 0;
+            rv_target_read_register(&regs[i], regno[i]);
+        }
+
+        regs += n;
+        regno += n;
+        num -= n;
+    }
+}
+
+/*
+ * The hart is halted: go through it with abstract commands, so its caches
+ * see what is written and what it has not written back yet is read. The
+ * system bus would go around them.
+ */
+void rv_target_read_memory(uint8_t* mem, uint64_t addr, uint32_t len)
+{
+    if (((uint32_t)mem & 3) == 0 && (addr & 3) == 0 && (len & 3) == 0) {
+        rv_memory_read(mem, addr, len / 4, RV_AAMSIZE_32BITS);
+    } else if (((uint32_t)mem & 1) == 0 && (addr & 1) == 0 && (len & 1) == 0) {
+        rv_memory_read(mem, addr, len / 2, RV_AAMSIZE_16BITS);
+    } else {
+        rv_memory_read(mem, addr, len, RV_AAMSIZE_8BITS);
+    }
+    rv_software_breakpoint_mask(mem, addr, len, false);
+}
+
+/*
+ * Read through the system bus only, which does not need the hart halted.
+ * Returns false if there is no system bus access or it failed.
+ */
+bool rv_target_read_memory_running(uint8_t* mem, uint64_t addr, uint32_t len)
+{
+    return target.sba && rv_sba_read(mem, addr, len);
 }
 
 void rv_target_write_memory(const uint8_t* mem, uint64_t addr, uint32_t len)
@@ -973,12 +1731,25 @@ void rv_target_write_memory(const uint8_t* mem, uint64_t addr, uint32_t len)
     } else {
         rv_memory_write(mem, addr, len, RV_AAMSIZE_8BITS);
     }
+    rv_software_breakpoint_mask((uint8_t*)mem, addr, len, true);
+}
+
+/*
+ * Write memory while the hart runs, only possible through the system bus.
+ * Breakpoints are not masked, this is for data.
+ */
+bool rv_target_write_memory_running(const uint8_t* mem, uint64_t addr, uint32_t len)
+{
+    return target.sba && rv_sba_write(mem, addr, len);
 }
 
 void rv_target_reset(void)
 {
     uint32_t i;
 
+    rv_reg_cache_invalidate();
+    target.dcsr_step = RV_DCSR_STEP_UNKNOWN;
+
     target.dm.dmcontrol.value = 0;
     target.dm.dmcontrol.dmactive = 1;
     target.dm.dmcontrol.haltreq = 1;
@@ -986,6 +1757,7 @@ void rv_target_reset(void)
     target.dm.dmcontrol.hartreset = 1;
     target.dm.dmcontrol.ndmreset = 1;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
@@ -1011,6 +1783,7 @@ void rv_target_reset(void)
         target.dm.dmcontrol.ackhavereset = 1;
     }
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 }
 
 void rv_target_halt(void)
@@ -1019,6 +1792,7 @@ void rv_target_halt(void)
     target.dm.dmcontrol.haltreq = 1;
     target.dm.dmcontrol.dmactive = 1;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 }
 
 void rv_target_halt_check(rv_target_halt_info_t* halt_info)
@@ -1028,30 +1802,43 @@ void rv_target_halt_check(rv_target_halt_info_t* halt_info)
     uint32_t wp_addr_base_regno;
     uint32_t wp_addr_offset;
     uint32_t mc_hit;
-    uint64_t tselect;
+    uint64_t tselect, trigger, tdata1;
+    bool icount_done;
 
     rv_dmi_read(RV_DM_DEBUG_MODULE_STATUS, &target.dm.dmstatus.value);
     if (target.dm.dmstatus.allhalted) {
         rv_target_read_register(&dcsr.value, RV_REG_DCSR);
+        icount_done = target.icount_active;
+        if (target.icount_active) {
+            /* the icount trigger is armed for one run only */
+            rv_target_read_register(&tselect, RV_REG_TSELECT);
+            rv_hardware_breakpoint_clear(target.icount_trigger);
+            rv_target_write_register(&tselect, RV_REG_TSELECT);
+            target.icount_active = false;
+        }
         if (dcsr.cause == RV_CSR_DCSR_CAUSE_EBREAK) {
             halt_info->reason = rv_target_halt_reason_software_breakpoint;
+        } else if ((dcsr.cause == RV_CSR_DCSR_CAUSE_TRIGGER) && icount_done) {
+            halt_info->reason = rv_target_halt_reason_other;
         } else if (dcsr.cause == RV_CSR_DCSR_CAUSE_TRIGGER) {
             halt_info->reason = rv_target_halt_reason_other;
             rv_target_read_register(&tselect, RV_REG_TSELECT);
-            for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
+            for(i = 0; i < target.trigger_num; i++) {
                 if (hardware_breakpoints[i].type != rv_target_breakpoint_type_unused) {
-                    if (MXL_RV32 == target.misa.mxl) {
-                        target.tr32.tselect = i;
-                        rv_target_write_register(&target.tr32.tselect, RV_REG_TSELECT);
-                        rv_target_read_register(&target.tr32.tdata1.value, RV_REG_TDATA1);
-                        mc_hit = target.tr32.tdata1.mc.hit;
-                    } if (MXL_RV64 == target.misa.mxl) {
-                        target.tr64.tselect = i;
-                        rv_target_write_register((uint32_t*)&target.tr64.tselect, RV_REG_TSELECT);
-                        rv_target_read_register(&target.tr64.tdata1.value, RV_REG_TDATA1);
-                        mc_hit = target.tr64.tdata1.mc.hit;
+                    trigger = i;
+                    tdata1 = 0;
+                    rv_target_write_register(&trigger, RV_REG_TSELECT);
+                    rv_target_read_register(&tdata1, RV_REG_TDATA1);
+                    if (target.trigger_cap[i] & RV_TRIGGER_CAP_MCONTROL6) {
+                        mc_hit = (tdata1 & RV_MC6_HIT) != 0;
+                        tdata1 &= ~(uint64_t)RV_MC6_HIT;
+                    } else {
+                        mc_hit = (tdata1 & RV_MC_HIT) != 0;
+                        tdata1 &= ~(uint64_t)RV_MC_HIT;
                     }
                     if (mc_hit) {
+                        /* breakpoints stay in across stops now, hit is sticky */
+                        rv_target_write_register(&tdata1, RV_REG_TDATA1);
                         if (hardware_breakpoints[i].type == rv_target_breakpoint_type_hardware) {
                             halt_info->reason = rv_target_halt_reason_hardware_breakpoint;
                         } else if (hardware_breakpoints[i].type == rv_target_breakpoint_type_write_watchpoint) {
@@ -1102,7 +1889,10 @@ void rv_target_halt_check(rv_target_halt_info_t* halt_info)
                     halt_info->addr += wp_addr_offset;
                     if (halt_info->addr != 0xffffffff) {
                         for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
-                            if (halt_info->addr == hardware_breakpoints[i].addr) {
+                            /* watchpoints cover kind bytes from addr */
+                            if ((hardware_breakpoints[i].type != rv_target_breakpoint_type_unused) &&
+                                (halt_info->addr >= hardware_breakpoints[i].addr) &&
+                                (halt_info->addr < hardware_breakpoints[i].addr + (hardware_breakpoints[i].kind ? hardware_breakpoints[i].kind : 1))) {
                                 if (hardware_breakpoints[i].type == rv_target_breakpoint_type_write_watchpoint) {
                                     halt_info->reason = rv_target_halt_reason_write_watchpoint;
                                 }
@@ -1128,224 +1918,604 @@ void rv_target_halt_check(rv_target_halt_info_t* halt_info)
 
 void rv_target_resume(void)
 {
-    rv_target_read_register(&dcsr.value, RV_REG_DCSR);
-    dcsr.step = 0;
-    rv_target_write_register(&dcsr.value, RV_REG_DCSR);
+    rv_target_commit_breakpoints();
+    if (target.dcsr_step != 0) {
+        rv_target_read_register(&dcsr.value, RV_REG_DCSR);
+        dcsr.step = 0;
+        rv_target_write_register(&dcsr.value, RV_REG_DCSR);
+    }
+    rv_reg_cache_flush();
+    rv_reg_cache_invalidate();
 
     target.dm.dmcontrol.value = 0;
     target.dm.dmcontrol.resumereq = 1;
     target.dm.dmcontrol.dmactive = 1;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 }
 
 void rv_target_step(void)
 {
-    rv_target_read_register(&dcsr.value, RV_REG_DCSR);
-    dcsr.step = 1;
-    rv_target_write_register(&dcsr.value, RV_REG_DCSR);
+    rv_target_commit_breakpoints();
+    /* back to back steps leave dcsr alone, it already has step set */
+    if (target.dcsr_step != 1) {
+        rv_target_read_register(&dcsr.value, RV_REG_DCSR);
+        dcsr.step = 1;
+        rv_target_write_register(&dcsr.value, RV_REG_DCSR);
+    }
+    rv_reg_cache_flush();
+    rv_reg_cache_invalidate();
 
     target.dm.dmcontrol.value = 0;
     target.dm.dmcontrol.resumereq = 1;
     target.dm.dmcontrol.dmactive = 1;
     rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+    rv_dmi_flush();
 }
 
-void rv_target_insert_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t* err)
+/*
+ * Read dmstatus until the hart acknowledged the last resume request (if
+ * resumeack) and is halted (if halted), for up to RV_TARGET_CONFIG_STEP_SPIN
+ * reads. A failed read gives up, dmstatus would still hold the old value.
+ */
+static bool rv_target_status_wait(bool resumeack, bool halted)
 {
     uint32_t i;
-    uint64_t tselect;
-    uint64_t tselect_rd, tdata1_rd;
-    const uint16_t c_ebreak = 0x9002;
-    const uint32_t ebreak = 0x00100073;
 
-    if (type == rv_target_breakpoint_type_software) {
-        for(i = 0; i < RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM; i++) {
-            if (software_breakpoints[i].type == rv_target_breakpoint_type_unused) {
-                software_breakpoints[i].type = type;
-                software_breakpoints[i].addr = addr;
-                software_breakpoints[i].kind = kind;
-                rv_memory_read((uint8_t*)&software_breakpoints[i].inst,
-                                addr,
-                                (kind == 2) ? 1 : 2,
-                                RV_AAMSIZE_16BITS);
-                rv_memory_write((kind == 2) ? (const uint8_t*)&c_ebreak : (const uint8_t*)&ebreak,
-                                addr,
-                                (kind == 2) ? 1 : 2,
-                                RV_AAMSIZE_16BITS);
-                break;
-            }
+    for (i = 0; i < RV_TARGET_CONFIG_STEP_SPIN; i++) {
+        rv_dmi_read(RV_DM_DEBUG_MODULE_STATUS, &target.dm.dmstatus.value);
+        if (result != RV_DMI_RESULT_DONE) {
+            return false;
         }
-        if (i == RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM) {
-            *err = 0x0e;
-            return;
+        if ((!resumeack || target.dm.dmstatus.allresumeack) &&
+            (!halted || target.dm.dmstatus.allhalted)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Step and wait for the hart to halt again, for up to
+ * RV_TARGET_CONFIG_STEP_SPIN dmstatus reads. Returns false if it is still
+ * running by then (a step into a slow bus access or wfi), the caller polls
+ * for the halt as after a resume.
+ */
+bool rv_target_step_wait(void)
+{
+    rv_target_step();
+    /* halted before the step was acknowledged is the old halt */
+    return rv_target_status_wait(true, true);
+}
+
+/*
+ * Halt the running hart just long enough to read dpc and let it go again,
+ * for PC sampling: only dcsr and dpc are read, nothing is written back.
+ * Returns false, leaving the hart halted, if it stopped on its own (a
+ * breakpoint) and the halt is to be reported as usual. *pc is not touched
+ * if the hart did not halt within RV_TARGET_CONFIG_STEP_SPIN dmstatus reads
+ * or a read failed.
+ */
+bool rv_target_sample_pc(uint64_t* pc)
+{
+    rv_target_halt();
+    if (!rv_target_status_wait(false, true)) {
+        /* take the request back, it is not to halt the hart later on */
+        target.dm.dmcontrol.value = 0;
+        target.dm.dmcontrol.dmactive = 1;
+        rv_dmi_write(RV_DM_DEBUG_MODULE_CONTROL, target.dm.dmcontrol.value);
+        rv_dmi_flush();
+        return true;
+    }
+
+    rv_target_read_register(&dcsr.value, RV_REG_DCSR);
+    if (dcsr.cause != RV_CSR_DCSR_CAUSE_HALT_REQ) {
+        return false;
+    }
+    *pc = 0;
+    rv_target_read_register(pc, RV_REG_DPC);
+    rv_target_resume();
+    /* or the next dmstatus read may still see it halted */
+    rv_target_status_wait(true, false);
+    return true;
+}
+
+/*
+ * Breakpoint changes from GDB are only recorded in the tables. GDB takes
+ * all of them out at every stop and puts them back before it resumes, a
+ * remove followed by the same insert cancels out and the rest is applied to
+ * the hart in one go right before it runs again.
+ */
+static uint32_t rv_software_breakpoint_hash(uint64_t addr)
+{
+    /* instructions are at least 2 byte aligned */
+    return ((uint32_t)(addr >> 1) * 2654435761u) % RV_TARGET_SOFTWARE_BREAKPOINT_NUM;
+}
+
+static int32_t rv_software_breakpoint_find(uint64_t addr)
+{
+    uint32_t i, j;
+
+    for(i = 0, j = rv_software_breakpoint_hash(addr); i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM; i++) {
+        if (software_breakpoints[j].state == RV_SOFTWARE_BREAKPOINT_FREE) {
+            break;
+        }
+        if ((software_breakpoints[j].state == RV_SOFTWARE_BREAKPOINT_USED) &&
+            (software_breakpoints[j].addr == addr)) {
+            return j;
         }
+        j = (j + 1) % RV_TARGET_SOFTWARE_BREAKPOINT_NUM;
+    }
+    return -1;
+}
+
+static void rv_software_breakpoint_delete(uint32_t index)
+{
+    /* the end of a probe run needs no marker */
+    if (software_breakpoints[(index + 1) % RV_TARGET_SOFTWARE_BREAKPOINT_NUM].state == RV_SOFTWARE_BREAKPOINT_FREE) {
+        software_breakpoints[index].state = RV_SOFTWARE_BREAKPOINT_FREE;
     } else {
+        software_breakpoints[index].state = RV_SOFTWARE_BREAKPOINT_DELETED;
+    }
+    software_breakpoints[index].pending = RV_BREAKPOINT_PENDING_NONE;
+    software_breakpoint_num--;
+}
+
+static void rv_software_breakpoint_write(rv_software_breakpoint_t* bp, bool ebreak)
+{
+    const uint16_t c_ebreak = 0x9002;
+    const uint32_t ebreak_inst = 0x00100073;
+    const uint8_t* inst;
+
+    if (ebreak) {
+        inst = (bp->kind == 2) ? (const uint8_t*)&c_ebreak : (const uint8_t*)&ebreak_inst;
+    } else {
+        inst = (const uint8_t*)&bp->inst;
+    }
+    rv_memory_write(inst, bp->addr, (bp->kind == 2) ? 1 : 2, RV_AAMSIZE_16BITS);
+}
+
+static uint64_t rv_trigger_mcontrol(uint32_t i, rv_target_breakpoint_type_t type, uint32_t match, bool chain)
+{
+    uint32_t xlen = (MXL_RV32 == target.misa.mxl) ? 32 : 64;
+    uint64_t tdata1;
+
+    tdata1 = (uint64_t)((target.trigger_cap[i] & RV_TRIGGER_CAP_MCONTROL6) ? 6 : 2) << (xlen - 4);
+    tdata1 |= (uint64_t)1 << (xlen - 5);    /* dmode */
+    tdata1 |= RV_MC_ACTION_DEBUG | RV_MC_M | RV_MC_MATCH(match);
+    if (target.misa.s) {
+        tdata1 |= RV_MC_S;
+    }
+    if (target.misa.u) {
+        tdata1 |= RV_MC_U;
+    }
+    if (chain) {
+        tdata1 |= RV_MC_CHAIN;
+    }
+    switch(type) {
+        case rv_target_breakpoint_type_hardware:
+            tdata1 |= RV_MC_EXECUTE;
+            break;
+        case rv_target_breakpoint_type_write_watchpoint:
+            tdata1 |= RV_MC_STORE;
+            break;
+        case rv_target_breakpoint_type_read_watchpoint:
+            tdata1 |= RV_MC_LOAD;
+            break;
+        case rv_target_breakpoint_type_access_watchpoint:
+            tdata1 |= RV_MC_STORE | RV_MC_LOAD;
+            break;
+        default:
+            break;
+    }
+    return tdata1;
+}
+
+/*
+ * Walk the triggers with tselect until it does not stick or tinfo reports
+ * none, and note what each can do. Without tinfo the type in tdata1 is all
+ * there is to go on. The WARL match field is tried out once here, so later
+ * inserts need no read back.
+ */
+static void rv_trigger_discover(void)
+{
+    uint32_t i;
+    uint32_t xlen = (MXL_RV32 == target.misa.mxl) ? 32 : 64;
+    uint64_t tselect, tselect_rd, tinfo, tdata1, tdata1_rd;
+
+    target.trigger_num = 0;
+    for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
+        tselect = i;
         tselect_rd = 0;
-        tdata1_rd = 0;
-        rv_target_read_register(&tselect, RV_REG_TSELECT);
-        for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
-            if (hardware_breakpoints[i].type == rv_target_breakpoint_type_unused) {
-                hardware_breakpoints[i].type = type;
-                hardware_breakpoints[i].addr = addr;
-                hardware_breakpoints[i].kind = kind;
-                if (MXL_RV32 == target.misa.mxl) {
-                    target.tr32.tselect = i;
-                    rv_target_write_register(&target.tr32.tselect, RV_REG_TSELECT);
-                    rv_target_read_register(&tselect_rd, RV_REG_TSELECT);
-                    if (target.tr32.tselect != tselect_rd) {
-                        *err = 0x0e;
-                        return;
-                    }
-                    rv_target_read_register(&target.tr32.tdata1.value, RV_REG_TDATA1);
-                    target.tr32.tdata1.mc.dmode = 1;
-                    target.tr32.tdata1.mc.action = 1;
-                    target.tr32.tdata1.mc.match = 0;
-                    target.tr32.tdata1.mc.m = 1;
-                    if (target.misa.s) {
-                        target.tr32.tdata1.mc.s = 1;
-                    }
-                    if (target.misa.u) {
-                        target.tr32.tdata1.mc.u = 1;
-                    }
-                    switch(type) {
-                        case rv_target_breakpoint_type_hardware:
-                            target.tr32.tdata1.mc.execute = 1;
-                            break;
-                        case rv_target_breakpoint_type_write_watchpoint:
-                            target.tr32.tdata1.mc.store = 1;
-                            break;
-                        case rv_target_breakpoint_type_read_watchpoint:
-                            target.tr32.tdata1.mc.load = 1;
-                            break;
-                        case rv_target_breakpoint_type_access_watchpoint:
-                            target.tr32.tdata1.mc.store = 1;
-                            target.tr32.tdata1.mc.load = 1;
-                            break;
-                        default:
-                            break;
-                    }
-                    rv_target_write_register(&target.tr32.tdata1.value, RV_REG_TDATA1);
-                    rv_target_read_register(&tdata1_rd, RV_REG_TDATA1);
-                    if (target.tr32.tdata1.value != tdata1_rd) {
-                        *err = 0x0e;
-                        return;
-                    }
-                    rv_target_write_register(&hardware_breakpoints[target.tr32.tselect].addr, RV_REG_TDATA2);
-                } else if (MXL_RV64 == target.misa.mxl) {
-                    target.tr64.tselect = i;
-                    rv_target_write_register(&target.tr64.tselect, RV_REG_TSELECT);
-                    rv_target_read_register(&tselect_rd, RV_REG_TSELECT);
-                    if (target.tr64.tselect != tselect_rd) {
-                        *err = 0x0e;
-                        return;
-                    }
-                    rv_target_read_register(&target.tr64.tdata1.value, RV_REG_TDATA1);
-                    target.tr64.tdata1.mc.dmode = 1;
-                    target.tr64.tdata1.mc.action = 1;
-                    target.tr64.tdata1.mc.match = 0;
-                    target.tr64.tdata1.mc.m = 1;
-                    if (target.misa.s) {
-                        target.tr64.tdata1.mc.s = 1;
-                    }
-                    if (target.misa.u) {
-                        target.tr64.tdata1.mc.u = 1;
-                    }
-                    switch(type) {
-                        case rv_target_breakpoint_type_hardware:
-                            target.tr64.tdata1.mc.execute = 1;
-                            break;
-                        case rv_target_breakpoint_type_write_watchpoint:
-                            target.tr64.tdata1.mc.store = 1;
-                            break;
-                        case rv_target_breakpoint_type_read_watchpoint:
-                            target.tr64.tdata1.mc.load = 1;
-                            break;
-                        case rv_target_breakpoint_type_access_watchpoint:
-                            target.tr64.tdata1.mc.store = 1;
-                            target.tr64.tdata1.mc.load = 1;
-                            break;
-                        default:
-                            break;
-                    }
-                    rv_target_write_register(&target.tr64.tdata1.value, RV_REG_TDATA1);
-                    rv_target_read_register(&tdata1_rd, RV_REG_TDATA1);
-                    if (target.tr64.tdata1.value != tdata1_rd) {
-                        *err = 0x0e;
-                        return;
-                    }
-                    rv_target_write_register(&hardware_breakpoints[target.tr64.tselect].addr, RV_REG_TDATA2);
+        rv_target_write_register(&tselect, RV_REG_TSELECT);
+        rv_target_read_register(&tselect_rd, RV_REG_TSELECT);
+        if (err_flag || (tselect_rd != tselect)) {
+            break;
+        }
+        tinfo = 0;
+        rv_target_read_register(&tinfo, RV_REG_TINFO);
+        if (err_flag) {
+            tdata1 = 0;
+            rv_target_read_register(&tdata1, RV_REG_TDATA1);
+            tinfo = 1 << ((tdata1 >> (xlen - 4)) & 0xf);
+        }
+        tinfo &= 0xffff;
+        if ((tinfo == 0) || (tinfo == 1)) {
+            break;
+        }
+
+        target.trigger_cap[i] = 0;
+        target.trigger_maskmax[i] = 0;
+        if (tinfo & (1 << 6)) {
+            target.trigger_cap[i] |= RV_TRIGGER_CAP_MCONTROL6;
+        } else if (tinfo & (1 << 2)) {
+            target.trigger_cap[i] |= RV_TRIGGER_CAP_MCONTROL;
+        }
+        if (tinfo & (1 << 3)) {
+            target.trigger_cap[i] |= RV_TRIGGER_CAP_ICOUNT;
+        }
+
+        if (target.trigger_cap[i] & (RV_TRIGGER_CAP_MCONTROL | RV_TRIGGER_CAP_MCONTROL6)) {
+            tdata1 = rv_trigger_mcontrol(i, rv_target_breakpoint_type_access_watchpoint, RV_MC_MATCH_NAPOT, false);
+            tdata1_rd = 0;
+            rv_target_write_register(&tdata1, RV_REG_TDATA1);
+            rv_target_read_register(&tdata1_rd, RV_REG_TDATA1);
+            if ((tdata1_rd & RV_MC_MATCH(0xf)) == RV_MC_MATCH(RV_MC_MATCH_NAPOT)) {
+                target.trigger_cap[i] |= RV_TRIGGER_CAP_NAPOT;
+                /* mcontrol6 has no maskmax, any size may work */
+                if (target.trigger_cap[i] & RV_TRIGGER_CAP_MCONTROL6) {
+                    target.trigger_maskmax[i] = xlen - 1;
+                } else {
+                    target.trigger_maskmax[i] = (tdata1_rd >> (xlen - 11)) & 0x3f;
                 }
-                break;
+            }
+            tdata1 = rv_trigger_mcontrol(i, rv_target_breakpoint_type_access_watchpoint, RV_MC_MATCH_GE, true);
+            tdata1_rd = 0;
+            rv_target_write_register(&tdata1, RV_REG_TDATA1);
+            rv_target_read_register(&tdata1_rd, RV_REG_TDATA1);
+            if ((tdata1_rd & (RV_MC_MATCH(0xf) | RV_MC_CHAIN)) == (RV_MC_MATCH(RV_MC_MATCH_GE) | RV_MC_CHAIN)) {
+                target.trigger_cap[i] |= RV_TRIGGER_CAP_RANGE;
             }
         }
-        rv_target_write_register(&tselect, RV_REG_TSELECT);
-        if (i == RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM) {
-            *err = 0x0e;
-            return;
+        rv_target_write_register(&zero, RV_REG_TDATA1);
+        target.trigger_num = i + 1;
+    }
+    err_flag = false;
+}
+
+/*
+ * How trigger i would watch [addr, addr + len): one NAPOT match if the
+ * range is a naturally aligned power of two, else a >=/< pair chained to
+ * trigger i + 1, else only the first address as before.
+ */
+static uint32_t rv_trigger_match(uint32_t i, rv_target_breakpoint_type_t type, uint64_t addr, uint32_t len)
+{
+    uint32_t n;
+
+    if ((type == rv_target_breakpoint_type_hardware) || (len <= 1)) {
+        return RV_MC_MATCH_EQUAL;
+    }
+    if (((len & (len - 1)) == 0) && ((addr & (len - 1)) == 0) &&
+        (target.trigger_cap[i] & RV_TRIGGER_CAP_NAPOT)) {
+        for(n = 0; (1u << n) < len; n++) {
+        }
+        if (n <= target.trigger_maskmax[i]) {
+            return RV_MC_MATCH_NAPOT;
         }
     }
-    *err = 0;
-    return;
+    if ((i + 1 < target.trigger_num) &&
+        (target.trigger_cap[i] & RV_TRIGGER_CAP_RANGE) &&
+        (target.trigger_cap[i + 1] & RV_TRIGGER_CAP_RANGE) &&
+        (hardware_breakpoints[i + 1].type == rv_target_breakpoint_type_unused)) {
+        return RV_MC_MATCH_GE;
+    }
+    return RV_MC_MATCH_EQUAL;
+}
+
+static void rv_hardware_breakpoint_set(uint32_t i)
+{
+    uint64_t tselect = i;
+    uint64_t tdata1, tdata2;
+    rv_hardware_breakpoint_t* bp = &hardware_breakpoints[i];
+
+    tdata2 = bp->addr;
+    if (bp->match == RV_MC_MATCH_NAPOT) {
+        tdata2 |= (bp->kind >> 1) - 1;
+    } else if (bp->match == RV_MC_MATCH_LT) {
+        tdata2 = bp->addr + bp->kind;
+    }
+    tdata1 = rv_trigger_mcontrol(i, bp->type, bp->match, bp->match == RV_MC_MATCH_GE);
+
+    rv_target_write_register(&tselect, RV_REG_TSELECT);
+    rv_target_write_register(&zero, RV_REG_TDATA1);
+    rv_target_write_register(&tdata2, RV_REG_TDATA2);
+    rv_target_write_register(&tdata1, RV_REG_TDATA1);
 }
 
-void rv_target_remove_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t* err)
+static void rv_hardware_breakpoint_clear(uint32_t i)
+{
+    uint64_t tselect = i;
+
+    rv_target_write_register(&tselect, RV_REG_TSELECT);
+    rv_target_write_register(&zero, RV_REG_TDATA1);
+}
+
+/*
+ * Apply the pending changes, removals first so their triggers are free.
+ */
+static void rv_target_commit_breakpoints(void)
 {
     uint32_t i;
     uint64_t tselect;
-    uint64_t tselect_rd;
+    bool tselect_saved = false;
+
+    for(i = 0; software_breakpoint_num && (i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM); i++) {
+        if (software_breakpoints[i].pending == RV_BREAKPOINT_PENDING_REMOVE) {
+            rv_software_breakpoint_write(&software_breakpoints[i], false);
+            rv_software_breakpoint_delete(i);
+        }
+    }
+    for(i = 0; software_breakpoint_num && (i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM); i++) {
+        if (software_breakpoints[i].pending == RV_BREAKPOINT_PENDING_INSERT) {
+            rv_memory_read((uint8_t*)&software_breakpoints[i].inst,
+                            software_breakpoints[i].addr,
+                            (software_breakpoints[i].kind == 2) ? 1 : 2,
+                            RV_AAMSIZE_16BITS);
+            rv_software_breakpoint_write(&software_breakpoints[i], true);
+            software_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
+        }
+    }
+
+    for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
+        if (hardware_breakpoints[i].pending == RV_BREAKPOINT_PENDING_NONE) {
+            continue;
+        }
+        if (!tselect_saved) {
+            rv_target_read_register(&tselect, RV_REG_TSELECT);
+            tselect_saved = true;
+        }
+        if (hardware_breakpoints[i].pending == RV_BREAKPOINT_PENDING_REMOVE) {
+            rv_hardware_breakpoint_clear(i);
+            hardware_breakpoints[i].type = rv_target_breakpoint_type_unused;
+        } else {
+            rv_hardware_breakpoint_set(i);
+        }
+        hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
+    }
+    if (tselect_saved) {
+        rv_target_write_register(&tselect, RV_REG_TSELECT);
+    }
+}
 
+/*
+ * Software breakpoints that are in target memory read back as the original
+ * instruction, and a write over one updates the instruction kept for it.
+ */
+static void rv_software_breakpoint_mask(uint8_t* mem, uint64_t addr, uint32_t len, bool write)
+{
+    uint32_t i, j, size;
+    uint64_t a;
+    bool hit;
+
+    for(i = 0; software_breakpoint_num && (i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM); i++) {
+        if ((software_breakpoints[i].state != RV_SOFTWARE_BREAKPOINT_USED) ||
+            (software_breakpoints[i].pending == RV_BREAKPOINT_PENDING_INSERT)) {
+            continue;
+        }
+        size = (software_breakpoints[i].kind == 2) ? 2 : 4;
+        hit = false;
+        for(j = 0; j < size; j++) {
+            a = software_breakpoints[i].addr + j;
+            if ((a >= addr) && (a < addr + len)) {
+                if (write) {
+                    ((uint8_t*)&software_breakpoints[i].inst)[j] = mem[a - addr];
+                } else {
+                    mem[a - addr] = ((uint8_t*)&software_breakpoints[i].inst)[j];
+                }
+                hit = true;
+            }
+        }
+        if (hit && write && (software_breakpoints[i].pending == RV_BREAKPOINT_PENDING_NONE)) {
+            rv_software_breakpoint_write(&software_breakpoints[i], true);
+        }
+    }
+}
+
+static int32_t rv_hardware_breakpoint_alloc(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind)
+{
+    uint32_t i, n, match;
+
+    for(i = 0; i < target.trigger_num; i++) {
+        if ((hardware_breakpoints[i].type != rv_target_breakpoint_type_unused) ||
+            !(target.trigger_cap[i] & (RV_TRIGGER_CAP_MCONTROL | RV_TRIGGER_CAP_MCONTROL6))) {
+            continue;
+        }
+        match = rv_trigger_match(i, type, addr, kind);
+        for(n = i + ((match == RV_MC_MATCH_GE) ? 1 : 0); i <= n; i++) {
+            hardware_breakpoints[i].type = type;
+            hardware_breakpoints[i].addr = addr;
+            hardware_breakpoints[i].kind = kind;
+            hardware_breakpoints[i].match = match;
+            hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_INSERT;
+            match = RV_MC_MATCH_LT;
+        }
+        return n;
+    }
+    return -1;
+}
+
+/*
+ * Run count (at most RV_TARGET_ICOUNT_MAX) instructions with an icount
+ * trigger and halt, the caller waits for the halt as after a resume.
+ * Returns false if the hart has no free icount trigger.
+ */
+bool rv_target_step_count(uint32_t count)
+{
+    uint32_t i;
+    uint32_t xlen = (MXL_RV32 == target.misa.mxl) ? 32 : 64;
+    uint64_t tselect, trigger, tdata1;
+
+    rv_target_commit_breakpoints();
+    for(i = 0; i < target.trigger_num; i++) {
+        if ((target.trigger_cap[i] & RV_TRIGGER_CAP_ICOUNT) &&
+            (hardware_breakpoints[i].type == rv_target_breakpoint_type_unused)) {
+            break;
+        }
+    }
+    if ((i == target.trigger_num) || (count == 0) || (count > RV_TARGET_ICOUNT_MAX)) {
+        return false;
+    }
+
+    tdata1 = (uint64_t)3 << (xlen - 4);     /* icount */
+    tdata1 |= (uint64_t)1 << (xlen - 5);    /* dmode */
+    tdata1 |= (count << 10) | (1 << 9) | 1; /* count, m, action debug mode */
+    if (target.misa.s) {
+        tdata1 |= (1 << 7);
+    }
+    if (target.misa.u) {
+        tdata1 |= (1 << 6);
+    }
+    trigger = i;
+    rv_target_read_register(&tselect, RV_REG_TSELECT);
+    rv_target_write_register(&trigger, RV_REG_TSELECT);
+    rv_target_write_register(&tdata1, RV_REG_TDATA1);
+    rv_target_write_register(&tselect, RV_REG_TSELECT);
+    target.icount_trigger = i;
+    target.icount_active = true;
+
+    rv_target_resume();
+    return true;
+}
+
+void rv_target_insert_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t owners, uint32_t* err)
+{
+    uint32_t i, j;
+    int32_t index;
+
+    *err = 0;
     if (type == rv_target_breakpoint_type_software) {
-        for(i = 0; i < RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM; i++) {
-            if ((software_breakpoints[i].type == type) &&
-                (software_breakpoints[i].addr == addr) &&
-                (software_breakpoints[i].kind == kind)) {
-                rv_memory_write((const uint8_t*)&software_breakpoints[i].inst,
-                                addr,
-                                (kind == 2) ? 1 : 2,
-                                RV_AAMSIZE_16BITS);
-                software_breakpoints[i].type = rv_target_breakpoint_type_unused;
-                break;
+        index = rv_software_breakpoint_find(addr);
+        if (index >= 0) {
+            /* put back before it was taken out, or inserted twice */
+            if (software_breakpoints[index].kind == kind) {
+                if (software_breakpoints[index].pending == RV_BREAKPOINT_PENDING_REMOVE) {
+                    software_breakpoints[index].pending = RV_BREAKPOINT_PENDING_NONE;
+                    software_breakpoints[index].owners = 0;
+                }
+                software_breakpoints[index].owners |= owners;
+                return;
             }
+            /* same address, other size: out with the old one first */
+            software_breakpoints[index].pending = RV_BREAKPOINT_PENDING_REMOVE;
+            rv_target_commit_breakpoints();
         }
-        if (i == RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM) {
-            *err = 0x0e;
-            return;
+        for(i = 0, j = rv_software_breakpoint_hash(addr); i < RV_TARGET_SOFTWARE_BREAKPOINT_NUM; i++) {
+            if (software_breakpoints[j].state != RV_SOFTWARE_BREAKPOINT_USED) {
+                software_breakpoints[j].state = RV_SOFTWARE_BREAKPOINT_USED;
+                software_breakpoints[j].addr = addr;
+                software_breakpoints[j].kind = kind;
+                software_breakpoints[j].pending = RV_BREAKPOINT_PENDING_INSERT;
+                software_breakpoints[j].owners = owners;
+                software_breakpoint_num++;
+                return;
+            }
+            j = (j + 1) % RV_TARGET_SOFTWARE_BREAKPOINT_NUM;
         }
+        *err = 0x0e;
     } else {
-        tselect_rd = 0;
-        rv_target_read_register(&tselect, RV_REG_TSELECT);
-        for(i = 0; i < RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM; i++) {
+        for(i = 0; i < target.trigger_num; i++) {
             if ((hardware_breakpoints[i].type == type) &&
                 (hardware_breakpoints[i].addr == addr) &&
                 (hardware_breakpoints[i].kind == kind)) {
-                if (MXL_RV32 == target.misa.mxl) {
-                    target.tr32.tselect = i;
-                    rv_target_write_register(&target.tr32.tselect, RV_REG_TSELECT);
-                    rv_target_read_register(&tselect_rd, RV_REG_TSELECT);
-                    if (target.tr32.tselect != tselect_rd) {
-                        *err = 0x0e;
-                        return;
-                    }
-                } else if (MXL_RV64 == target.misa.mxl) {
-                    target.tr64.tselect = i;
-                    rv_target_write_register(&target.tr64.tselect, RV_REG_TSELECT);
-                    rv_target_read_register(&tselect_rd, RV_REG_TSELECT);
-                    if (target.tr64.tselect != tselect_rd) {
-                        *err = 0x0e;
-                        return;
+                /* put back before it was taken out, or inserted again with new conditions */
+                if (hardware_breakpoints[i].pending == RV_BREAKPOINT_PENDING_REMOVE) {
+                    hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
+                    if (hardware_breakpoints[i].match == RV_MC_MATCH_GE) {
+                        hardware_breakpoints[i + 1].pending = RV_BREAKPOINT_PENDING_NONE;
                     }
                 }
-                rv_target_write_register(&zero, RV_REG_TDATA1);
-                hardware_breakpoints[i].type = rv_target_breakpoint_type_unused;
-                break;
+                return;
             }
         }
-        rv_target_write_register(&tselect, RV_REG_TSELECT);
-        if (i == RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM) {
+        index = rv_hardware_breakpoint_alloc(type, addr, kind);
+        if (index < 0) {
+            /* triggers waiting to be removed are still taken, free them now */
+            rv_target_commit_breakpoints();
+            index = rv_hardware_breakpoint_alloc(type, addr, kind);
+        }
+        if (index < 0) {
             *err = 0x0e;
-            return;
         }
     }
+}
+
+void rv_target_remove_breakpoint(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind, uint32_t owners, uint32_t* err)
+{
+    uint32_t i, n;
+    int32_t index;
+
     *err = 0;
-    return;
+    if (type == rv_target_breakpoint_type_software) {
+        index = rv_software_breakpoint_find(addr);
+        if ((index >= 0) &&
+            (software_breakpoints[index].pending != RV_BREAKPOINT_PENDING_REMOVE) &&
+            (software_breakpoints[index].kind == kind) &&
+            (software_breakpoints[index].owners & owners)) {
+            software_breakpoints[index].owners &= ~owners;
+            if (software_breakpoints[index].owners != 0) {
+                /* someone else still wants it in */
+                return;
+            }
+            if (software_breakpoints[index].pending == RV_BREAKPOINT_PENDING_INSERT) {
+                rv_software_breakpoint_delete(index);
+            } else {
+                software_breakpoints[index].pending = RV_BREAKPOINT_PENDING_REMOVE;
+            }
+            return;
+        }
+    } else {
+        for(i = 0; i < target.trigger_num; i++) {
+            if ((hardware_breakpoints[i].type == type) &&
+                (hardware_breakpoints[i].pending != RV_BREAKPOINT_PENDING_REMOVE) &&
+                (hardware_breakpoints[i].addr == addr) &&
+                (hardware_breakpoints[i].kind == kind)) {
+                /* a range takes this and the next trigger */
+                for(n = i + ((hardware_breakpoints[i].match == RV_MC_MATCH_GE) ? 1 : 0); i <= n; i++) {
+                    if (hardware_breakpoints[i].pending == RV_BREAKPOINT_PENDING_INSERT) {
+                        hardware_breakpoints[i].type = rv_target_breakpoint_type_unused;
+                        hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_NONE;
+                    } else {
+                        hardware_breakpoints[i].pending = RV_BREAKPOINT_PENDING_REMOVE;
+                    }
+                }
+                return;
+            }
+        }
+    }
+    *err = 0x0e;
+}
+
+/*
+ * RV_TARGET_BREAKPOINT_OWNER_* of the breakpoint at addr, 0 if there is none.
+ */
+uint32_t rv_target_breakpoint_owners(rv_target_breakpoint_type_t type, uint64_t addr)
+{
+    uint32_t i;
+    int32_t index;
+
+    if (type == rv_target_breakpoint_type_software) {
+        index = rv_software_breakpoint_find(addr);
+        if ((index >= 0) && (software_breakpoints[index].pending != RV_BREAKPOINT_PENDING_REMOVE)) {
+            return software_breakpoints[index].owners;
+        }
+    } else {
+        for(i = 0; i < target.trigger_num; i++) {
+            if ((hardware_breakpoints[i].type == type) &&
+                (hardware_breakpoints[i].pending != RV_BREAKPOINT_PENDING_REMOVE) &&
+                (hardware_breakpoints[i].addr == addr)) {
+                return RV_TARGET_BREAKPOINT_OWNER_GDB;
+            }
+        }
+    }
+    return 0;
 }
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+
+#ifndef __GDB_AGENT_H__
+#define __GDB_AGENT_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+#define GDB_AGENT_OK                (0)
+#define GDB_AGENT_ERR_OPCODE        (1)
+#define GDB_AGENT_ERR_STACK         (2)
+#define GDB_AGENT_ERR_CODE          (3)
+#define GDB_AGENT_ERR_DIV_ZERO      (4)
+#define GDB_AGENT_ERR_STEPS         (5)
+
+/*
+ * Called by the trace opcodes with a target memory range to collect, NULL
+ * when only the value of the expression is wanted.
+ */
+typedef void (*gdb_agent_collect_t)(uint64_t addr, uint32_t size);
+
+/*
+ * Evaluate a GDB agent expression against the halted hart, the top of the
+ * stack at '''end''' goes to result. Returns GDB_AGENT_OK or an error code.
+ */
+int gdb_agent_eval(const uint8_t* code, uint32_t len, gdb_agent_collect_t collect, int64_t* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_AGENT_H__ */
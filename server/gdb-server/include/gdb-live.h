@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#ifndef __GDB_LIVE_H__
+#define __GDB_LIVE_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+/*
+ * Live watch: the variables added are read over the system bus rate times a
+ * second, up to configTICK_RATE_HZ, while the hart runs. Each sample is a
+ * record of the tick count and the variables, in a ring buffer that drops
+ * the oldest records when the host does not keep up. Variables are added
+ * while not sampling.
+ */
+bool gdb_live_add(uint64_t addr, uint32_t size);
+void gdb_live_clear(void);
+bool gdb_live_start(uint32_t rate);
+void gdb_live_stop(void);
+
+/*
+ * Called while the target runs: take a sample if one is due.
+ */
+void gdb_live_poll(void);
+
+/*
+ * Ticks until the next sample is due, portMAX_DELAY when not sampling.
+ */
+TickType_t gdb_live_wait(void);
+
+/*
+ * Take the oldest records out of the buffer, as many as fit in size,
+ * printed '''dropped,count:''' then for each record the tick count (8 hex
+ * digits) and the bytes of each variable (2 hex digits each, in target
+ * order). Returns the length printed.
+ */
+uint32_t gdb_live_read(char* text, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_LIVE_H__ */
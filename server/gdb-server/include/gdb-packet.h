@@ -24,22 +24,56 @@
 #include "port.h"
 #include "usbd_conf.h"
 
+/*
+ * A reply, or a streamed ‘X’/‘vFlashWrite’ command, can be several fragments: ‘$’ goes out with the FIRST one,
+ * the checksum runs over all of them and is appended to the LAST one.
+ */
+#define GDB_PACKET_FLAG_FIRST       (1 << 0)
+#define GDB_PACKET_FLAG_LAST        (1 << 1)
+#define GDB_PACKET_FLAG_WHOLE       (GDB_PACKET_FLAG_FIRST | GDB_PACKET_FLAG_LAST)
+/* command fragments only: set on the LAST one if the checksum did not match */
+#define GDB_PACKET_FLAG_ERROR       (1 << 2)
+
 typedef struct {
     uint32_t len;
     uint8_t* data;
+    uint8_t* buffer;    /* pool buffer owning data, NULL if none */
+    uint32_t flags;
 } gdb_packet_t;
 
 extern QueueHandle_t gdb_cmd_packet_xQueue;
 extern QueueHandle_t gdb_rsp_packet_xQueue;
-extern uint8_t cmd_buffer[GDB_PACKET_BUFF_SIZE + 64];
-extern uint8_t rsp_buffer[GDB_PACKET_BUFF_SIZE + 64];
 
 void gdb_packet_init(void);
 
+/*
+ * Hand a received command buffer back to the pool once it is served.
+ */
+void gdb_cmd_packet_release(gdb_packet_t* packet);
+
+/*
+ * Take a free response buffer from the pool, the send task returns it to
+ * the pool after it went out.
+ */
+void gdb_rsp_packet_acquire(gdb_packet_t* packet);
+
+/*
+ * Called from the USB interrupt when a CDC0 OUT transfer was received or an
+ * IN transfer completed, wakes up the waiting packet task.
+ */
+void gdb_packet_received_from_isr(void);
+void gdb_packet_sent_from_isr(void);
+
 /*
  * Enter NoAckMode.
  */
 void gdb_set_no_ack_mode(bool no_ack_mode);
+bool gdb_get_no_ack_mode(void);
+
+/*
+ * Run-length encode replies, turned on once GDB sent qSupported.
+ */
+void gdb_set_rle_mode(bool rle_mode);
 
 #ifdef __cplusplus
 }
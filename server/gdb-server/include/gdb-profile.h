@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#ifndef __GDB_PROFILE_H__
+#define __GDB_PROFILE_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+/*
+ * Sample the pc of the running hart rate times a second, up to
+ * configTICK_RATE_HZ, into a histogram of [low, high), cleared at start.
+ */
+void gdb_profile_start(uint64_t low, uint64_t high, uint32_t rate);
+void gdb_profile_stop(void);
+
+/*
+ * Called while the target runs: take a sample if one is due. Returns false
+ * if the hart halted on its own meanwhile, its halt is to be reported.
+ */
+bool gdb_profile_poll(void);
+
+/*
+ * Ticks until the next sample is due, portMAX_DELAY when not profiling.
+ */
+TickType_t gdb_profile_wait(void);
+
+/*
+ * Print the histogram as text, a header line then '''addr count''' for each
+ * bucket with samples. Continues from *index (0 to begin), returns the
+ * length written, 0 once everything was printed.
+ */
+uint32_t gdb_profile_dump(uint32_t* index, char* text, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_PROFILE_H__ */
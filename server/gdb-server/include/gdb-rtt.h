@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#ifndef __GDB_RTT_H__
+#define __GDB_RTT_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+/*
+ * RTT: the target logs into a ring buffer described by a control block
+ * with the ID "SEGGER RTT" somewhere in its RAM. Once started, the probe
+ * looks for the control block in [addr, addr + size) and then moves the
+ * bytes of up-buffer 0 to the second CDC interface, all over the system
+ * bus while the hart runs.
+ */
+bool gdb_rtt_start(uint64_t addr, uint32_t size);
+void gdb_rtt_stop(void);
+
+/*
+ * Called while the target runs: look for the control block or move the
+ * new bytes if a poll is due.
+ */
+void gdb_rtt_poll(void);
+
+/*
+ * Ticks until the next poll is due, portMAX_DELAY when stopped.
+ */
+TickType_t gdb_rtt_wait(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_RTT_H__ */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#ifndef __GDB_SEMIHOST_H__
+#define __GDB_SEMIHOST_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+typedef enum gdb_semihost_result_e
+{
+    gdb_semihost_result_none = 0,   /* not a call the probe serves, report the halt */
+    gdb_semihost_result_resume,     /* served, a0 and pc are set */
+    gdb_semihost_result_read,       /* console input, ask the host */
+    gdb_semihost_result_exit,       /* the program exited */
+} gdb_semihost_result_t;
+
+/*
+ * Called with console output to pass on, at most
+ * GDB_SEMIHOST_CONFIG_BUFFER_SIZE bytes at a time.
+ */
+typedef void (*gdb_semihost_output_t)(const uint8_t* data, uint32_t len);
+
+void gdb_semihost_init(void);
+
+/*
+ * The hart halted at an ebreak: serve it if it is the semihosting sequence
+ * '''slli x0, x0, 0x1f''', '''ebreak''', '''srai x0, x0, 7'''. Console output is
+ * buffered and only goes to output when the buffer is full.
+ */
+gdb_semihost_result_t gdb_semihost_call(gdb_semihost_output_t output);
+
+/*
+ * The buffer of a console read, and how the host answered it: the number of
+ * bytes read or -1.
+ */
+void gdb_semihost_read_args(uint64_t* addr, uint32_t* len);
+void gdb_semihost_read_done(int32_t ret);
+
+uint32_t gdb_semihost_exit_code(void);
+
+/*
+ * Pass on the buffered output, and the ticks until that is due because the
+ * oldest byte waited GDB_SEMIHOST_CONFIG_FLUSH_MS, portMAX_DELAY when empty.
+ */
+void gdb_semihost_flush(gdb_semihost_output_t output);
+TickType_t gdb_semihost_wait(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_SEMIHOST_H__ */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#ifndef __GDB_TRACE_H__
+#define __GDB_TRACE_H__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "port.h"
+
+/*
+ * Forget all tracepoints, trace state variables and collected frames.
+ */
+void gdb_trace_init(void);
+
+/*
+ * True while an experiment is running, its tracepoints are in the target.
+ */
+bool gdb_trace_running(void);
+
+/*
+ * Serve a '''QT''' or '''qT''' packet, the reply goes to reply. Returns the reply
+ * length, 0 for the empty reply of an unsupported packet.
+ */
+uint32_t gdb_trace_command(const char* packet, char* reply, uint32_t size);
+
+/*
+ * The hart halted at pc: if that is a tracepoint of the running experiment,
+ * collect a frame and return true with the kind of its breakpoint, the
+ * caller steps over it and resumes.
+ */
+bool gdb_trace_hit(uint64_t pc, uint32_t* kind);
+
+/*
+ * Reads from the frame selected with '''QTFrame''', instead of the target.
+ * gdb_trace_frame_registers() returns false if no registers were collected,
+ * only the pc (the tracepoint address) is set then. gdb_trace_frame_memory()
+ * returns the number of bytes from addr on held by the frame.
+ */
+bool gdb_trace_frame_selected(void);
+bool gdb_trace_frame_registers(uint64_t* regs);
+uint32_t gdb_trace_frame_memory(uint8_t* mem, uint64_t addr, uint32_t len);
+
+/*
+ * Trace state variables for the '''getv''', '''setv''' and '''tracev''' agent opcodes.
+ */
+bool gdb_trace_tsv_get(uint32_t num, int64_t* value);
+bool gdb_trace_tsv_set(uint32_t num, int64_t value);
+void gdb_trace_tsv_collect(uint32_t num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GDB_TRACE_H__ */
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-agent.h"
+#include "gdb-trace.h"
+#include "riscv-target.h"
+
+/*
+ * GDB agent expression opcodes, see "Agent Expressions" in the GDB manual.
+ */
+#define AX_ADD              0x02
+#define AX_SUB              0x03
+#define AX_MUL              0x04
+#define AX_DIV_SIGNED       0x05
+#define AX_DIV_UNSIGNED     0x06
+#define AX_REM_SIGNED       0x07
+#define AX_REM_UNSIGNED     0x08
+#define AX_LSH              0x09
+#define AX_RSH_SIGNED       0x0a
+#define AX_RSH_UNSIGNED     0x0b
+#define AX_TRACE            0x0c
+#define AX_TRACE_QUICK      0x0d
+#define AX_LOG_NOT          0x0e
+#define AX_BIT_AND          0x0f
+#define AX_BIT_OR           0x10
+#define AX_BIT_XOR          0x11
+#define AX_BIT_NOT          0x12
+#define AX_EQUAL            0x13
+#define AX_LESS_SIGNED      0x14
+#define AX_LESS_UNSIGNED    0x15
+#define AX_EXT              0x16
+#define AX_REF8             0x17
+#define AX_REF16            0x18
+#define AX_REF32            0x19
+#define AX_REF64            0x1a
+#define AX_IF_GOTO          0x20
+#define AX_GOTO             0x21
+#define AX_CONST8           0x22
+#define AX_CONST16          0x23
+#define AX_CONST32          0x24
+#define AX_CONST64          0x25
+#define AX_REG              0x26
+#define AX_END              0x27
+#define AX_DUP              0x28
+#define AX_POP              0x29
+#define AX_ZERO_EXT         0x2a
+#define AX_SWAP             0x2b
+#define AX_GETV             0x2c
+#define AX_SETV             0x2d
+#define AX_TRACEV           0x2e
+#define AX_TRACENZ          0x2f
+#define AX_TRACE16          0x30
+#define AX_PICK             0x32
+#define AX_ROT              0x33
+
+static uint64_t gdb_agent_operand(const uint8_t* code, uint32_t pc, uint32_t size)
+{
+    uint64_t value = 0;
+    uint32_t i;
+
+    /* operands are big endian */
+    for (i = 0; i < size; i++) {
+        value = (value << 8) | code[pc + i];
+    }
+    return value;
+}
+
+int gdb_agent_eval(const uint8_t* code, uint32_t len, gdb_agent_collect_t collect, int64_t* result)
+{
+    int64_t stack[GDB_AGENT_CONFIG_STACK_SIZE];
+    uint32_t sp = 0;
+    uint32_t pc = 0;
+    uint32_t steps;
+    uint32_t size;
+    uint8_t op;
+    uint64_t value;
+    uint64_t a, b;
+
+/* stack[sp - 1] is the top */
+#define NEED(n)     if (sp < (n)) return GDB_AGENT_ERR_STACK
+#define ROOM(n)     if (sp + (n) > GDB_AGENT_CONFIG_STACK_SIZE) return GDB_AGENT_ERR_STACK
+#define OPERAND(n)  if (pc + (n) > len) return GDB_AGENT_ERR_CODE
+
+    for (steps = 0; steps < GDB_AGENT_CONFIG_MAX_STEPS; steps++) {
+        if (pc >= len) {
+            return GDB_AGENT_ERR_CODE;
+        }
+        op = code[pc++];
+        switch (op) {
+        case AX_ADD:
+        case AX_SUB:
+        case AX_MUL:
+        case AX_DIV_SIGNED:
+        case AX_DIV_UNSIGNED:
+        case AX_REM_SIGNED:
+        case AX_REM_UNSIGNED:
+        case AX_LSH:
+        case AX_RSH_SIGNED:
+        case AX_RSH_UNSIGNED:
+        case AX_BIT_AND:
+        case AX_BIT_OR:
+        case AX_BIT_XOR:
+        case AX_EQUAL:
+        case AX_LESS_SIGNED:
+        case AX_LESS_UNSIGNED:
+            NEED(2);
+            a = stack[sp - 2];
+            b = stack[sp - 1];
+            sp--;
+            if ((b == 0) && ((op == AX_DIV_SIGNED) || (op == AX_DIV_UNSIGNED) ||
+                             (op == AX_REM_SIGNED) || (op == AX_REM_UNSIGNED))) {
+                return GDB_AGENT_ERR_DIV_ZERO;
+            }
+            switch (op) {
+            case AX_ADD:            value = a + b; break;
+            case AX_SUB:            value = a - b; break;
+            case AX_MUL:            value = a * b; break;
+            /* INT64_MIN / -1 overflows, it wraps as on the hart */
+            case AX_DIV_SIGNED:     value = (b == (uint64_t)-1) ? (0 - a) : (uint64_t)((int64_t)a / (int64_t)b); break;
+            case AX_DIV_UNSIGNED:   value = a / b; break;
+            case AX_REM_SIGNED:     value = (b == (uint64_t)-1) ? 0 : (uint64_t)((int64_t)a % (int64_t)b); break;
+            case AX_REM_UNSIGNED:   value = a % b; break;
+            /* shifts by the width or more are not defined in C, all bits go out */
+            case AX_LSH:            value = (b < 64) ? (a << b) : 0; break;
+            case AX_RSH_SIGNED:     value = (uint64_t)((int64_t)a >> ((b < 64) ? b : 63)); break;
+            case AX_RSH_UNSIGNED:   value = (b < 64) ? (a >> b) : 0; break;
+            case AX_BIT_AND:        value = a & b; break;
+            case AX_BIT_OR:         value = a | b; break;
+            case AX_BIT_XOR:        value = a ^ b; break;
+            case AX_EQUAL:          value = (a == b); break;
+            case AX_LESS_SIGNED:    value = ((int64_t)a < (int64_t)b); break;
+            default:                value = (a < b); break;
+            }
+            stack[sp - 1] = value;
+            break;
+        case AX_LOG_NOT:
+            NEED(1);
+            stack[sp - 1] = !stack[sp - 1];
+            break;
+        case AX_BIT_NOT:
+            NEED(1);
+            stack[sp - 1] = ~stack[sp - 1];
+            break;
+        case AX_EXT:
+        case AX_ZERO_EXT:
+            OPERAND(1);
+            NEED(1);
+            size = code[pc++];
+            if ((size > 0) && (size < 64)) {
+                value = stack[sp - 1] & ((1ULL << size) - 1);
+                if ((op == AX_EXT) && (value & (1ULL << (size - 1)))) {
+                    value |= ~((1ULL << size) - 1);
+                }
+                stack[sp - 1] = value;
+            }
+            break;
+        case AX_REF8:
+        case AX_REF16:
+        case AX_REF32:
+        case AX_REF64:
+            NEED(1);
+            size = 1 << (op - AX_REF8);
+            value = 0;
+            rv_target_read_memory((uint8_t*)&value, stack[sp - 1], size);
+            stack[sp - 1] = value;
+            break;
+        case AX_IF_GOTO:
+            OPERAND(2);
+            NEED(1);
+            sp--;
+            if (stack[sp]) {
+                pc = gdb_agent_operand(code, pc, 2);
+            } else {
+                pc += 2;
+            }
+            break;
+        case AX_GOTO:
+            OPERAND(2);
+            pc = gdb_agent_operand(code, pc, 2);
+            break;
+        case AX_CONST8:
+        case AX_CONST16:
+        case AX_CONST32:
+        case AX_CONST64:
+            size = 1 << (op - AX_CONST8);
+            OPERAND(size);
+            ROOM(1);
+            stack[sp++] = gdb_agent_operand(code, pc, size);
+            pc += size;
+            break;
+        case AX_REG:
+            OPERAND(2);
+            ROOM(1);
+            value = 0;
+            rv_target_read_register(&value, gdb_agent_operand(code, pc, 2));
+            pc += 2;
+            stack[sp++] = value;
+            break;
+        case AX_END:
+            NEED(1);
+            *result = stack[sp - 1];
+            return GDB_AGENT_OK;
+        case AX_DUP:
+            NEED(1);
+            ROOM(1);
+            stack[sp] = stack[sp - 1];
+            sp++;
+            break;
+        case AX_POP:
+            NEED(1);
+            sp--;
+            break;
+        case AX_SWAP:
+            NEED(2);
+            value = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = value;
+            break;
+        case AX_PICK:
+            OPERAND(1);
+            size = code[pc++];
+            NEED(size + 1);
+            ROOM(1);
+            stack[sp] = stack[sp - 1 - size];
+            sp++;
+            break;
+        case AX_ROT:
+            /* a b c => c a b */
+            NEED(3);
+            value = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = stack[sp - 3];
+            stack[sp - 3] = value;
+            break;
+        case AX_TRACE:
+            NEED(2);
+            if (collect) {
+                collect(stack[sp - 2], stack[sp - 1]);
+            }
+            sp -= 2;
+            break;
+        case AX_TRACENZ:
+            /* up to and including the first zero byte, a string */
+            NEED(2);
+            if (collect) {
+                for (size = 0; size < (uint64_t)stack[sp - 1]; size++) {
+                    value = 0;
+                    rv_target_read_memory((uint8_t*)&value, stack[sp - 2] + size, 1);
+                    if (value == 0) {
+                        size++;
+                        break;
+                    }
+                }
+                collect(stack[sp - 2], size);
+            }
+            sp -= 2;
+            break;
+        case AX_GETV:
+            OPERAND(2);
+            ROOM(1);
+            if (!gdb_trace_tsv_get(gdb_agent_operand(code, pc, 2), &stack[sp])) {
+                return GDB_AGENT_ERR_OPCODE;
+            }
+            pc += 2;
+            sp++;
+            break;
+        case AX_SETV:
+            OPERAND(2);
+            NEED(1);
+            if (!gdb_trace_tsv_set(gdb_agent_operand(code, pc, 2), stack[sp - 1])) {
+                return GDB_AGENT_ERR_OPCODE;
+            }
+            pc += 2;
+            break;
+        case AX_TRACEV:
+            OPERAND(2);
+            if (collect) {
+                gdb_trace_tsv_collect(gdb_agent_operand(code, pc, 2));
+            }
+            pc += 2;
+            break;
+        case AX_TRACE_QUICK:
+        case AX_TRACE16:
+            size = (op == AX_TRACE16) ? 2 : 1;
+            OPERAND(size);
+            NEED(1);
+            if (collect) {
+                collect(stack[sp - 1], gdb_agent_operand(code, pc, size));
+            }
+            pc += size;
+            break;
+        default:
+            return GDB_AGENT_ERR_OPCODE;
+        }
+    }
+    return GDB_AGENT_ERR_STEPS;
+
+#undef NEED
+#undef ROOM
+#undef OPERAND
+}
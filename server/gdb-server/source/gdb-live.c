@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-live.h"
+#include "riscv-target.h"
+
+typedef struct gdb_live_var_s
+{
+    uint64_t addr;
+    uint32_t size;
+} gdb_live_var_t;
+
+typedef struct gdb_live_s
+{
+    bool running;
+    TickType_t interval;
+    TickType_t next;
+
+    gdb_live_var_t vars[GDB_LIVE_CONFIG_VAR_NUM];
+    uint32_t var_num;
+    uint32_t record_size;   /* tick count and all the variables */
+    uint32_t record_num;    /* records the buffer holds */
+
+    uint32_t head;          /* oldest record */
+    uint32_t count;
+    uint32_t dropped;
+} gdb_live_t;
+
+static gdb_live_t gdb_live_i;
+static uint8_t live_buffer[GDB_LIVE_CONFIG_BUFFER_SIZE];
+
+bool gdb_live_add(uint64_t addr, uint32_t size)
+{
+    /* the record layout is fixed by gdb_live_start() */
+    if (gdb_live_i.running || (gdb_live_i.var_num == GDB_LIVE_CONFIG_VAR_NUM) ||
+        ((size != 1) && (size != 2) && (size != 4) && (size != 8))) {
+        return false;
+    }
+    gdb_live_i.vars[gdb_live_i.var_num].addr = addr;
+    gdb_live_i.vars[gdb_live_i.var_num].size = size;
+    gdb_live_i.var_num++;
+    return true;
+}
+
+void gdb_live_clear(void)
+{
+    memset(&gdb_live_i, 0, sizeof(gdb_live_i));
+}
+
+bool gdb_live_start(uint32_t rate)
+{
+    uint32_t i;
+
+    /* a running hart can only be read through the system bus */
+    if ((gdb_live_i.var_num == 0) || !rv_target_sba_supported()) {
+        return false;
+    }
+    gdb_live_i.record_size = sizeof(uint32_t);
+    for (i = 0; i < gdb_live_i.var_num; i++) {
+        gdb_live_i.record_size += gdb_live_i.vars[i].size;
+    }
+    gdb_live_i.record_num = GDB_LIVE_CONFIG_BUFFER_SIZE / gdb_live_i.record_size;
+    gdb_live_i.head = 0;
+    gdb_live_i.count = 0;
+    gdb_live_i.dropped = 0;
+    gdb_live_i.interval = ((rate == 0) || (rate >= configTICK_RATE_HZ)) ? 1 : (configTICK_RATE_HZ / rate);
+    gdb_live_i.next = xTaskGetTickCount();
+    gdb_live_i.running = true;
+    return true;
+}
+
+void gdb_live_stop(void)
+{
+    gdb_live_i.running = false;
+}
+
+TickType_t gdb_live_wait(void)
+{
+    TickType_t now;
+
+    if (!gdb_live_i.running) {
+        return portMAX_DELAY;
+    }
+    now = xTaskGetTickCount();
+    if ((int32_t)(gdb_live_i.next - now) <= 0) {
+        return 0;
+    }
+    return gdb_live_i.next - now;
+}
+
+void gdb_live_poll(void)
+{
+    TickType_t now;
+    uint8_t* record;
+    uint32_t i;
+
+    if (gdb_live_wait() != 0) {
+        return;
+    }
+    now = xTaskGetTickCount();
+    gdb_live_i.next += gdb_live_i.interval;
+    if ((int32_t)(gdb_live_i.next - now) < 0) {
+        gdb_live_i.next = now + gdb_live_i.interval;
+    }
+
+    if (gdb_live_i.count == gdb_live_i.record_num) {
+        /* the host is behind, the oldest record goes */
+        gdb_live_i.head = (gdb_live_i.head + 1) % gdb_live_i.record_num;
+        gdb_live_i.count--;
+        gdb_live_i.dropped++;
+    }
+    record = &live_buffer[((gdb_live_i.head + gdb_live_i.count) % gdb_live_i.record_num) * gdb_live_i.record_size];
+    memcpy(record, &now, sizeof(uint32_t));
+    record += sizeof(uint32_t);
+    for (i = 0; i < gdb_live_i.var_num; i++) {
+        if (!rv_target_read_memory_running(record, gdb_live_i.vars[i].addr, gdb_live_i.vars[i].size)) {
+            memset(record, 0, gdb_live_i.vars[i].size);
+        }
+        record += gdb_live_i.vars[i].size;
+    }
+    gdb_live_i.count++;
+}
+
+uint32_t gdb_live_read(char* text, uint32_t size)
+{
+    const char digits[] = "0123456789abcdef";
+    uint8_t* record;
+    uint32_t len, num, i, j;
+    uint32_t tick;
+
+    /* '''dropped,count:''' with 8 hex digits each, then two per record byte */
+    num = gdb_live_i.count;
+    if ((gdb_live_i.record_size != 0) && (num > (size - 18) / (gdb_live_i.record_size * 2))) {
+        num = (size - 18) / (gdb_live_i.record_size * 2);
+    }
+    len = snprintf(text, size, "%08x,%08x:", (unsigned int)gdb_live_i.dropped, (unsigned int)num);
+    gdb_live_i.dropped = 0;
+
+    for (i = 0; i < num; i++) {
+        record = &live_buffer[gdb_live_i.head * gdb_live_i.record_size];
+        memcpy(&tick, record, sizeof(uint32_t));
+        len += snprintf(&text[len], size - len, "%08x", (unsigned int)tick);
+        for (j = sizeof(uint32_t); j < gdb_live_i.record_size; j++) {
+            text[len++] = digits[record[j] >> 4];
+            text[len++] = digits[record[j] & 0xf];
+        }
+        gdb_live_i.head = (gdb_live_i.head + 1) % gdb_live_i.record_num;
+        gdb_live_i.count--;
+    }
+    return len;
+}
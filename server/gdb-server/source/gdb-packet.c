@@ -25,61 +25,75 @@ extern __IO uint32_t cdc0_receive_length;
 
 extern usb_core_driver USB_OTG_dev;
 
+/* upper bound for one wait on the USB core, in case a transfer never completes */
+#define GDB_PACKET_USB_TIMEOUT      (100 / portTICK_PERIOD_MS)
+
+typedef enum {
+    gdb_packet_state_idle = 0,
+    gdb_packet_state_data,
+    gdb_packet_state_checksum1,
+    gdb_packet_state_checksum2,
+} gdb_packet_state_t;
+
+typedef struct gdb_packet_rx_s
+{
+    gdb_packet_state_t state;
+    uint32_t len;
+    uint8_t checksum;
+    uint8_t rx_checksum;
+    bool overflow;
+    bool stream;
+    uint8_t* buffer;
+} gdb_packet_rx_t;
+
 TaskHandle_t gdb_cmd_packet_xHandle = NULL;
 TaskHandle_t gdb_rsp_packet_xHandle = NULL;
 QueueHandle_t gdb_cmd_packet_xQueue;
 QueueHandle_t gdb_rsp_packet_xQueue;
-
-uint8_t cmd_buffer[GDB_PACKET_BUFF_SIZE + 64];
-uint8_t rsp_buffer[GDB_PACKET_BUFF_SIZE + 64];
+QueueHandle_t gdb_cmd_free_xQueue;
+QueueHandle_t gdb_rsp_free_xQueue;
+SemaphoreHandle_t gdb_usb_tx_xMutex;
+static TaskHandle_t volatile gdb_usb_tx_waiting = NULL;
 
 static gdb_packet_t cmd;
 static gdb_packet_t rsp;
+static gdb_packet_t last_rsp;
+static gdb_packet_rx_t rx;
+static uint8_t ctrl_c[2] = {'\x03', '\0'};
 
 bool no_ack_mode;
+bool rle_mode;
 
 static uint32_t gdb_packet_checksum(const uint8_t* p, uint32_t len);
+static uint32_t gdb_packet_rle(uint8_t* p, uint32_t len, uint32_t* checksum);
+static void gdb_packet_rx_byte(uint8_t c);
+static void gdb_packet_rx_fragment(uint32_t flags);
+static void gdb_packet_usb_send(const uint8_t* data, uint32_t len);
+static void gdb_packet_usb_write(const uint8_t* data, uint32_t len);
 
 void gdb_cmd_packet_vTask(void* pvParameters)
 {
     BaseType_t xReturned;
-    int dollar, sharp, total;
     uint8_t temp[CDC_ACM_DATA_PACKET_SIZE];
 
+    rx.state = gdb_packet_state_idle;
+    rx.buffer = NULL;
+
     for (;;) {
-        dollar = -1;
-        sharp = -1;
-        total = 0;
-        while (1) {
-            if (USBD_CONFIGURED == USB_OTG_dev.dev.cur_status) {
-                cdc0_packet_receive = 0;
-                usbd_ep_recev(&USB_OTG_dev, CDC0_ACM_DATA_OUT_EP, temp, CDC_ACM_DATA_PACKET_SIZE);
-                while (!cdc0_packet_receive) {
-                    vTaskDelay(5 / portTICK_PERIOD_MS);
-                };
-                RV_LED_G(0);
-                for (int i = 0;i < cdc0_receive_length;i++) {
-                    if (-1 == dollar && '$' == temp[i]) {
-                        dollar = i + total;
-                    }
-                    if (-1 == sharp && '#' == temp[i]) {
-                        sharp = i + total;
-                    }
-                }
-                if (dollar >= 0) {
-                    memcpy(&cmd_buffer[total], temp, cdc0_receive_length);
-                }
-                total += cdc0_receive_length;
-                if (dollar >= 0 && sharp > 0) {
-                    break;
-                }
-                RV_LED_G(1);
+        if (USBD_CONFIGURED == USB_OTG_dev.dev.cur_status) {
+            cdc0_packet_receive = 0;
+            usbd_ep_recev(&USB_OTG_dev, CDC0_ACM_DATA_OUT_EP, temp, CDC_ACM_DATA_PACKET_SIZE);
+            while (!cdc0_packet_receive) {
+                ulTaskNotifyTake(pdTRUE, GDB_PACKET_USB_TIMEOUT);
+            };
+            RV_LED_G(0);
+            for (int i = 0;i < cdc0_receive_length;i++) {
+                gdb_packet_rx_byte(temp[i]);
             }
+            RV_LED_G(1);
+        } else {
+            vTaskDelay(GDB_PACKET_USB_TIMEOUT);
         }
-        cmd.len = sharp - dollar - 1;
-        cmd.data = &cmd_buffer[dollar + 1];
-        cmd.data[cmd.len] = '\0';
-        xQueueSend(gdb_cmd_packet_xQueue, &cmd, portMAX_DELAY);
     }
 }
 
@@ -90,37 +104,45 @@ void gdb_rsp_packet_vTask(void* pvParameters)
 
     for (;;) {
         xQueueReceive(gdb_rsp_packet_xQueue, &rsp, portMAX_DELAY);
-        checksum = gdb_packet_checksum((const uint8_t*)rsp.data, rsp.len);
-        snprintf(&rsp.data[rsp.len], 5, "#%02x|", checksum);
-        if (no_ack_mode) {
+        if (rsp.flags & GDB_PACKET_FLAG_FIRST) {
+            checksum = 0;
+        }
+        /* ‘-:’ replies go to the dlink host tool, it does not expand runs */
+        if (rle_mode && !((rsp.flags & GDB_PACKET_FLAG_FIRST) && (rsp.data[0] == '-'))) {
+            rsp.len = gdb_packet_rle(rsp.data, rsp.len, &checksum);
+        } else {
+            checksum += gdb_packet_checksum((const uint8_t*)rsp.data, rsp.len);
+        }
+        if (rsp.flags & GDB_PACKET_FLAG_LAST) {
+            snprintf(&rsp.data[rsp.len], 5, "#%02x|", checksum & 0xff);
+            rsp.len += 3;
+        }
+        if (rsp.flags & GDB_PACKET_FLAG_FIRST) {
             rsp.data -= 1;
             rsp.data[0] = '$';
-            rsp.len += 5;
-        } else {
-            rsp.data -= 2;
-            rsp.data[0] = '+';
-            rsp.data[1] = '$';
-            rsp.len += 6;
+            rsp.len += 1;
+        }
+        /*
+         * Only whole replies can be sent again on ‘-’, the last one keeps its
+         * buffer until the next reply goes out. The mutex keeps the receive
+         * task from sending it again while it is handed back.
+         */
+        xSemaphoreTake(gdb_usb_tx_xMutex, portMAX_DELAY);
+        if (last_rsp.buffer) {
+            xQueueSend(gdb_rsp_free_xQueue, &last_rsp.buffer, portMAX_DELAY);
+            last_rsp.buffer = NULL;
+            last_rsp.len = 0;
+        }
+        if (!no_ack_mode && (rsp.flags == GDB_PACKET_FLAG_WHOLE)) {
+            last_rsp = rsp;
         }
+        xSemaphoreGive(gdb_usb_tx_xMutex);
         RV_LED_G(0);
-        do {
-            if (USBD_CONFIGURED == USB_OTG_dev.dev.cur_status) {
-                cdc0_packet_sent = 0;
-                if (rsp.len >= CDC_ACM_DATA_PACKET_SIZE) {
-                    usbd_ep_send(&USB_OTG_dev, CDC0_ACM_DATA_IN_EP, rsp.data, CDC_ACM_DATA_PACKET_SIZE);
-                    rsp.data += CDC_ACM_DATA_PACKET_SIZE;
-                    rsp.len -= CDC_ACM_DATA_PACKET_SIZE;
-                } else {
-                    usbd_ep_send(&USB_OTG_dev, CDC0_ACM_DATA_IN_EP, rsp.data, rsp.len);
-                    rsp.data += rsp.len;
-                    rsp.len -= rsp.len;
-                }
-                while (!cdc0_packet_sent) {
-                    vTaskDelay(5 / portTICK_PERIOD_MS);
-                };
-            }
-        } while (rsp.len);
+        gdb_packet_usb_send(rsp.data, rsp.len);
         RV_LED_G(1);
+        if (last_rsp.buffer != rsp.buffer) {
+            xQueueSend(gdb_rsp_free_xQueue, &rsp.buffer, portMAX_DELAY);
+        }
     }
 }
 
@@ -128,16 +150,30 @@ void gdb_packet_init(void)
 {
     BaseType_t xReturned;
 
-    gdb_cmd_packet_xQueue = xQueueCreate(1, sizeof(gdb_packet_t));
+    uint8_t* buffer;
+
+    gdb_usb_tx_xMutex = xSemaphoreCreateMutex();
+
+    /* one extra slot for Ctrl+C, it does not use a pool buffer */
+    gdb_cmd_packet_xQueue = xQueueCreate(GDB_PACKET_CONFIG_QUEUE_DEPTH + 1, sizeof(gdb_packet_t));
     if (gdb_cmd_packet_xQueue == NULL) {
         /* Queue was not created and must not be used. */
     }
 
-    gdb_rsp_packet_xQueue= xQueueCreate(1, sizeof(gdb_packet_t));
+    gdb_rsp_packet_xQueue= xQueueCreate(GDB_PACKET_CONFIG_QUEUE_DEPTH, sizeof(gdb_packet_t));
     if (gdb_rsp_packet_xQueue == NULL) {
         /* Queue was not created and must not be used. */
     }
 
+    gdb_cmd_free_xQueue = xQueueCreate(GDB_PACKET_CONFIG_BUFF_NUM, sizeof(uint8_t*));
+    gdb_rsp_free_xQueue = xQueueCreate(GDB_PACKET_CONFIG_BUFF_NUM, sizeof(uint8_t*));
+    for (int i = 0; i < GDB_PACKET_CONFIG_BUFF_NUM; i++) {
+        buffer = pvPortMalloc(GDB_PACKET_BUFF_SIZE + 64);
+        xQueueSend(gdb_cmd_free_xQueue, &buffer, 0);
+        buffer = pvPortMalloc(GDB_PACKET_BUFF_SIZE + 64);
+        xQueueSend(gdb_rsp_free_xQueue, &buffer, 0);
+    }
+
     xReturned = xTaskCreate(gdb_cmd_packet_vTask,     /* Function that implements the task. */
                             "gdb_cmd_packet",         /* Text name for the task. */
                             256,                      /* Stack size in words, not bytes. */
@@ -161,11 +197,38 @@ void gdb_packet_init(void)
     }
 }
 
+/*---------------------------------------------------------------------------*/
+void gdb_cmd_packet_release(gdb_packet_t* packet)
+{
+    if (packet->buffer) {
+        xQueueSend(gdb_cmd_free_xQueue, &packet->buffer, portMAX_DELAY);
+        packet->buffer = NULL;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void gdb_rsp_packet_acquire(gdb_packet_t* packet)
+{
+    xQueueReceive(gdb_rsp_free_xQueue, &packet->buffer, portMAX_DELAY);
+    /* room for the leading ‘$’ */
+    packet->data = packet->buffer + 2;
+    packet->len = 0;
+    packet->flags = GDB_PACKET_FLAG_WHOLE;
+}
 /*---------------------------------------------------------------------------*/
 void gdb_set_no_ack_mode(bool mode)
 {
     no_ack_mode = mode;
 }
+
+bool gdb_get_no_ack_mode(void)
+{
+    return no_ack_mode;
+}
+
+void gdb_set_rle_mode(bool mode)
+{
+    rle_mode = mode;
+}
 /*---------------------------------------------------------------------------*/
 static uint32_t gdb_packet_checksum(const uint8_t* p, uint32_t len)
 {
@@ -179,3 +242,207 @@ static uint32_t gdb_packet_checksum(const uint8_t* p, uint32_t len)
 
     return checksum;
 }
+/*---------------------------------------------------------------------------*/
+/*
+ * Run-length encode in place, ‘c*n’ stands for c followed by n - 29 more
+ * copies of it, and add the encoded bytes to the checksum on the way.
+ * Runs of 6 and 7 would give ‘#’ and ‘$’ as count so they are cut to 5,
+ * counts above 97 are not printable. Runs shorter than 4 are left alone.
+ */
+static uint32_t gdb_packet_rle(uint8_t* p, uint32_t len, uint32_t* checksum)
+{
+    uint32_t i, j, n;
+    uint32_t sum = 0;
+
+    i = 0;
+    j = 0;
+    while (i < len) {
+        n = 0;
+        while ((i + n + 1 < len) && (p[i + n + 1] == p[i]) && (n < 97)) {
+            n++;
+        }
+        sum += p[j++] = p[i];
+        if (n < 3) {
+            i++;
+            continue;
+        }
+        if ((n == 6) || (n == 7)) {
+            n = 5;
+        }
+        sum += p[j++] = '*';
+        sum += p[j++] = n + 29;
+        i += n + 1;
+    }
+    *checksum += sum;
+
+    return j;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t gdb_packet_hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * RSP framing, fed one byte at a time so nothing that follows a packet in
+ * the same USB transfer is lost. Between packets, ‘-’ asks for the last
+ * reply again and a raw 0x03 is passed on as a Ctrl+C packet.
+ */
+static void gdb_packet_rx_byte(uint8_t c)
+{
+    switch (rx.state) {
+    case gdb_packet_state_idle:
+        if (c == '$') {
+            /* wait for the server to hand a buffer back if all are in use */
+            if (rx.buffer == NULL) {
+                xQueueReceive(gdb_cmd_free_xQueue, &rx.buffer, portMAX_DELAY);
+            }
+            rx.state = gdb_packet_state_data;
+            rx.len = 0;
+            rx.checksum = 0;
+            rx.overflow = false;
+            rx.stream = false;
+        } else if (c == '\x03') {
+            cmd.len = 1;
+            cmd.data = ctrl_c;
+            cmd.buffer = NULL;
+            cmd.flags = GDB_PACKET_FLAG_WHOLE;
+            xQueueSend(gdb_cmd_packet_xQueue, &cmd, portMAX_DELAY);
+        } else if (c == '-') {
+            xSemaphoreTake(gdb_usb_tx_xMutex, portMAX_DELAY);
+            if (!no_ack_mode && last_rsp.len) {
+                gdb_packet_usb_write(last_rsp.data, last_rsp.len);
+            }
+            xSemaphoreGive(gdb_usb_tx_xMutex);
+        }
+        /* acks ‘+’ and noise between packets are dropped */
+        break;
+    case gdb_packet_state_data:
+        if (c == '#') {
+            rx.state = gdb_packet_state_checksum1;
+        } else if (rx.len < GDB_PACKET_BUFF_SIZE + 63) {
+            rx.buffer[rx.len++] = c;
+            rx.checksum += c;
+            if (no_ack_mode && (rx.len == GDB_PACKET_CONFIG_STREAM_SIZE)) {
+                if (rx.stream) {
+                    gdb_packet_rx_fragment(0);
+                } else if ((rx.buffer[0] == 'X') ||
+                           (strncmp((const char*)rx.buffer, "vFlashWrite:", 12) == 0)) {
+                    rx.stream = true;
+                    gdb_packet_rx_fragment(GDB_PACKET_FLAG_FIRST);
+                }
+            }
+        } else {
+            rx.overflow = true;
+        }
+        break;
+    case gdb_packet_state_checksum1:
+        rx.rx_checksum = gdb_packet_hex_value(c) << 4;
+        rx.state = gdb_packet_state_checksum2;
+        break;
+    case gdb_packet_state_checksum2:
+        rx.rx_checksum |= gdb_packet_hex_value(c);
+        rx.state = gdb_packet_state_idle;
+        if (rx.stream) {
+            gdb_packet_rx_fragment(GDB_PACKET_FLAG_LAST |
+                                   ((rx.rx_checksum != rx.checksum) ? GDB_PACKET_FLAG_ERROR : 0));
+            break;
+        }
+        if (!no_ack_mode) {
+            if (rx.overflow || (rx.rx_checksum != rx.checksum)) {
+                gdb_packet_usb_send((const uint8_t*)"-", 1);
+                break;
+            }
+            gdb_packet_usb_send((const uint8_t*)"+", 1);
+        } else if (rx.overflow) {
+            break;
+        }
+        cmd.len = rx.len;
+        cmd.data = rx.buffer;
+        cmd.data[cmd.len] = '\0';
+        cmd.buffer = rx.buffer;
+        cmd.flags = GDB_PACKET_FLAG_WHOLE;
+        rx.buffer = NULL;
+        xQueueSend(gdb_cmd_packet_xQueue, &cmd, portMAX_DELAY);
+        break;
+    default:
+        rx.state = gdb_packet_state_idle;
+        break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Pass on what was received of a streamed packet so far, the server writes
+ * it out while the rest is still on the wire. Only done in NoAckMode, as a
+ * bad checksum can not be answered with ‘-’ once the data went out.
+ */
+static void gdb_packet_rx_fragment(uint32_t flags)
+{
+    cmd.len = rx.len;
+    cmd.data = rx.buffer;
+    cmd.data[cmd.len] = '\0';
+    cmd.buffer = rx.buffer;
+    cmd.flags = flags;
+    xQueueSend(gdb_cmd_packet_xQueue, &cmd, portMAX_DELAY);
+    rx.buffer = NULL;
+    rx.len = 0;
+    if (!(flags & GDB_PACKET_FLAG_LAST)) {
+        xQueueReceive(gdb_cmd_free_xQueue, &rx.buffer, portMAX_DELAY);
+    }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Acks go out from the receive task and replies from the send task, the
+ * mutex keeps them from interleaving on the endpoint. The whole frame is
+ * handed to the USB core as one transfer, it splits it into max packet
+ * size packets (and a trailing ZLP if needed) on its own.
+ */
+static void gdb_packet_usb_send(const uint8_t* data, uint32_t len)
+{
+    xSemaphoreTake(gdb_usb_tx_xMutex, portMAX_DELAY);
+    gdb_packet_usb_write(data, len);
+    xSemaphoreGive(gdb_usb_tx_xMutex);
+}
+
+/*
+ * The same with gdb_usb_tx_xMutex already taken.
+ */
+static void gdb_packet_usb_write(const uint8_t* data, uint32_t len)
+{
+    if (USBD_CONFIGURED == USB_OTG_dev.dev.cur_status) {
+        gdb_usb_tx_waiting = xTaskGetCurrentTaskHandle();
+        cdc0_packet_sent = 0;
+        usbd_ep_send(&USB_OTG_dev, CDC0_ACM_DATA_IN_EP, (uint8_t*)data, len);
+        while (!cdc0_packet_sent && (USBD_CONFIGURED == USB_OTG_dev.dev.cur_status)) {
+            ulTaskNotifyTake(pdTRUE, GDB_PACKET_USB_TIMEOUT);
+        };
+        gdb_usb_tx_waiting = NULL;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void gdb_packet_received_from_isr(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    if (gdb_cmd_packet_xHandle) {
+        vTaskNotifyGiveFromISR(gdb_cmd_packet_xHandle, &xHigherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+/*---------------------------------------------------------------------------*/
+void gdb_packet_sent_from_isr(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    if (gdb_usb_tx_waiting) {
+        vTaskNotifyGiveFromISR(gdb_usb_tx_waiting, &xHigherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
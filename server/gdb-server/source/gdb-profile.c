@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-profile.h"
+#include "riscv-target.h"
+
+typedef struct gdb_profile_s
+{
+    bool running;
+    uint64_t low;
+    uint64_t high;
+    uint32_t shift;         /* bucket size is 1 << shift bytes */
+    TickType_t interval;
+    TickType_t next;
+    uint32_t samples;
+    uint32_t outside;
+} gdb_profile_t;
+
+static gdb_profile_t gdb_profile_i;
+/* 16 bit counters as in a gmon.out histogram, they stop at 0xffff */
+static uint16_t profile_buckets[GDB_PROFILE_CONFIG_BUCKET_NUM];
+
+void gdb_profile_start(uint64_t low, uint64_t high, uint32_t rate)
+{
+    memset(profile_buckets, 0, sizeof(profile_buckets));
+    gdb_profile_i.low = low;
+    gdb_profile_i.high = (high > low) ? high : low + 1;
+    /* instructions are at least 2 byte aligned, no smaller buckets */
+    gdb_profile_i.shift = 1;
+    while (((gdb_profile_i.high - low - 1) >> gdb_profile_i.shift) >= GDB_PROFILE_CONFIG_BUCKET_NUM) {
+        gdb_profile_i.shift++;
+    }
+    /* at most once a tick, the server task has to block in between */
+    gdb_profile_i.interval = ((rate == 0) || (rate >= configTICK_RATE_HZ)) ? 1 : (configTICK_RATE_HZ / rate);
+    gdb_profile_i.next = xTaskGetTickCount();
+    gdb_profile_i.samples = 0;
+    gdb_profile_i.outside = 0;
+    gdb_profile_i.running = true;
+}
+
+void gdb_profile_stop(void)
+{
+    gdb_profile_i.running = false;
+}
+
+TickType_t gdb_profile_wait(void)
+{
+    TickType_t now;
+
+    if (!gdb_profile_i.running) {
+        return portMAX_DELAY;
+    }
+    now = xTaskGetTickCount();
+    if ((int32_t)(gdb_profile_i.next - now) <= 0) {
+        return 0;
+    }
+    return gdb_profile_i.next - now;
+}
+
+bool gdb_profile_poll(void)
+{
+    uint64_t pc = UINT64_MAX;
+    uint32_t i;
+
+    if (gdb_profile_wait() != 0) {
+        return true;
+    }
+    gdb_profile_i.next += gdb_profile_i.interval;
+    if ((int32_t)(gdb_profile_i.next - xTaskGetTickCount()) < 0) {
+        /* fell behind, do not try to catch up with a burst */
+        gdb_profile_i.next = xTaskGetTickCount() + gdb_profile_i.interval;
+    }
+
+    if (!rv_target_sample_pc(&pc)) {
+        return false;
+    }
+    if (pc == UINT64_MAX) {
+        return true;
+    }
+    gdb_profile_i.samples++;
+    if ((pc < gdb_profile_i.low) || (pc >= gdb_profile_i.high)) {
+        gdb_profile_i.outside++;
+        return true;
+    }
+    i = (pc - gdb_profile_i.low) >> gdb_profile_i.shift;
+    if (profile_buckets[i] != UINT16_MAX) {
+        profile_buckets[i]++;
+    }
+    return true;
+}
+
+/*
+ * An address as '''0x''' and XLEN / 4 hex digits, in two halves on RV64 as
+ * printf may not know 64 bit integers.
+ */
+static uint32_t gdb_profile_addr(char* text, uint32_t size, uint64_t addr)
+{
+    if (MXL_RV64 == rv_target_mxl()) {
+        return snprintf(text, size, "0x%08x%08x", (unsigned int)(addr >> 32), (unsigned int)addr);
+    }
+    return snprintf(text, size, "0x%08x", (unsigned int)addr);
+}
+
+uint32_t gdb_profile_dump(uint32_t* index, char* text, uint32_t size)
+{
+    uint32_t len = 0;
+    uint32_t i = *index;
+    /* '''0x12345678 65535\n''' */
+    uint32_t line = 2 + rv_target_mxl() * 8 + 7;
+
+    if (i == 0) {
+        len = snprintf(text, size, "low ");
+        len += gdb_profile_addr(&text[len], size - len, gdb_profile_i.low);
+        len += snprintf(&text[len], size - len, " high ");
+        len += gdb_profile_addr(&text[len], size - len, gdb_profile_i.high);
+        len += snprintf(&text[len], size - len, " bucket %u samples %u outside %u\n",
+                        (unsigned int)(1 << gdb_profile_i.shift),
+                        (unsigned int)gdb_profile_i.samples, (unsigned int)gdb_profile_i.outside);
+        i = 1;
+    }
+    /* bucket n is printed at index n + 1 */
+    for (; i <= GDB_PROFILE_CONFIG_BUCKET_NUM; i++) {
+        if (profile_buckets[i - 1] == 0) {
+            continue;
+        }
+        if (len + line >= size) {
+            break;
+        }
+        len += gdb_profile_addr(&text[len], size - len,
+                                gdb_profile_i.low + ((uint64_t)(i - 1) << gdb_profile_i.shift));
+        len += snprintf(&text[len], size - len, " %u\n", (unsigned int)profile_buckets[i - 1]);
+    }
+    *index = i;
+    return len;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-rtt.h"
+#include "riscv-target.h"
+#include "usb-serial.h"
+
+/*
+ * Control block layout: char acID[16], int MaxNumUpBuffers,
+ * int MaxNumDownBuffers, then the up-buffers, each of them
+ * { sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags } with pointers
+ * XLEN wide.
+ */
+#define RTT_ID                  "SEGGER RTT"
+#define RTT_ID_LEN              (sizeof(RTT_ID))
+#define RTT_UP_BUFFER_OFFSET    (24)
+
+typedef enum gdb_rtt_state_e
+{
+    gdb_rtt_state_stopped = 0,
+    gdb_rtt_state_scanning,
+    gdb_rtt_state_attached,
+} gdb_rtt_state_t;
+
+typedef struct gdb_rtt_s
+{
+    gdb_rtt_state_t state;
+    TickType_t next;
+
+    uint64_t scan_addr;
+    uint64_t scan_end;
+    uint64_t scan_next;
+
+    uint64_t buffer;        /* pBuffer of up-buffer 0 */
+    uint32_t size;          /* SizeOfBuffer */
+    uint64_t offsets;       /* address of WrOff, RdOff follows it */
+} gdb_rtt_t;
+
+static gdb_rtt_t gdb_rtt_i;
+static uint8_t rtt_buffer[GDB_RTT_CONFIG_CHUNK_SIZE];
+
+bool gdb_rtt_start(uint64_t addr, uint32_t size)
+{
+    if ((size < RTT_ID_LEN) || !rv_target_sba_supported()) {
+        return false;
+    }
+    gdb_rtt_i.scan_addr = addr & ~(uint64_t)3;
+    gdb_rtt_i.scan_end = addr + size;
+    gdb_rtt_i.scan_next = gdb_rtt_i.scan_addr;
+    gdb_rtt_i.next = xTaskGetTickCount();
+    gdb_rtt_i.state = gdb_rtt_state_scanning;
+    return true;
+}
+
+void gdb_rtt_stop(void)
+{
+    gdb_rtt_i.state = gdb_rtt_state_stopped;
+}
+
+TickType_t gdb_rtt_wait(void)
+{
+    TickType_t now;
+
+    if (gdb_rtt_i.state == gdb_rtt_state_stopped) {
+        return portMAX_DELAY;
+    }
+    now = xTaskGetTickCount();
+    if ((int32_t)(gdb_rtt_i.next - now) <= 0) {
+        return 0;
+    }
+    return gdb_rtt_i.next - now;
+}
+
+/*
+ * One chunk of the range per poll, so a control block the target sets up
+ * late is still found. Chunks overlap by the length of the ID.
+ */
+static void gdb_rtt_scan(void)
+{
+    uint64_t desc, buffer;
+    uint32_t len, i;
+    uint32_t ptr_size;
+    uint32_t words[3];
+
+    /* rtt_buffer may still be going out */
+    if (!usb_serial_ready()) {
+        return;
+    }
+    ptr_size = (rv_target_mxl() == MXL_RV32) ? 4 : 8;
+    len = GDB_RTT_CONFIG_CHUNK_SIZE;
+    if (gdb_rtt_i.scan_next + len > gdb_rtt_i.scan_end) {
+        len = (uint32_t)(gdb_rtt_i.scan_end - gdb_rtt_i.scan_next) & ~3u;
+    }
+    if ((len < RTT_ID_LEN) || !rv_target_read_memory_running(rtt_buffer, gdb_rtt_i.scan_next, len)) {
+        gdb_rtt_i.scan_next = gdb_rtt_i.scan_addr;
+        return;
+    }
+
+    /* the control block holds words, the ID is word aligned */
+    for (i = 0; i + RTT_ID_LEN <= len; i += 4) {
+        if (memcmp(&rtt_buffer[i], RTT_ID, RTT_ID_LEN) == 0) {
+            break;
+        }
+    }
+    if (i + RTT_ID_LEN > len) {
+        if (gdb_rtt_i.scan_next + len >= gdb_rtt_i.scan_end) {
+            gdb_rtt_i.scan_next = gdb_rtt_i.scan_addr;
+        } else {
+            gdb_rtt_i.scan_next += (len - RTT_ID_LEN + 1) & ~3u;
+        }
+        return;
+    }
+
+    /* pBuffer, then SizeOfBuffer, WrOff and RdOff of up-buffer 0 */
+    desc = gdb_rtt_i.scan_next + i + RTT_UP_BUFFER_OFFSET + ptr_size;
+    buffer = 0;
+    if (!rv_target_read_memory_running((uint8_t*)&buffer, desc, ptr_size) ||
+        !rv_target_read_memory_running((uint8_t*)words, desc + ptr_size, 12)) {
+        return;
+    }
+    if (words[0] == 0) {
+        /* not set up yet */
+        return;
+    }
+    gdb_rtt_i.buffer = buffer;
+    gdb_rtt_i.size = words[0];
+    gdb_rtt_i.offsets = desc + ptr_size + 4;
+    gdb_rtt_i.state = gdb_rtt_state_attached;
+}
+
+/*
+ * Move what the target wrote since the last poll, the contiguous part up to
+ * one chunk. RdOff is only advanced once the bytes are on their way.
+ * Returns true if more is waiting.
+ */
+static bool gdb_rtt_drain(void)
+{
+    uint32_t offsets[2];
+    uint32_t wr, rd, len;
+
+    if (!usb_serial_ready()) {
+        return true;
+    }
+    if (!rv_target_read_memory_running((uint8_t*)offsets, gdb_rtt_i.offsets, 8)) {
+        return false;
+    }
+    wr = offsets[0];
+    rd = offsets[1];
+    if ((wr >= gdb_rtt_i.size) || (rd >= gdb_rtt_i.size)) {
+        /* the target overwrote its control block, look for it again */
+        gdb_rtt_i.scan_next = gdb_rtt_i.scan_addr;
+        gdb_rtt_i.state = gdb_rtt_state_scanning;
+        return false;
+    }
+    if (wr == rd) {
+        return false;
+    }
+
+    len = (wr > rd) ? (wr - rd) : (gdb_rtt_i.size - rd);
+    if (len > GDB_RTT_CONFIG_CHUNK_SIZE) {
+        len = GDB_RTT_CONFIG_CHUNK_SIZE;
+    }
+    if (!rv_target_read_memory_running(rtt_buffer, gdb_rtt_i.buffer + rd, len) ||
+        !usb_serial_write(rtt_buffer, len)) {
+        return true;
+    }
+    rd = (rd + len) % gdb_rtt_i.size;
+    rv_target_write_memory_running((uint8_t*)&rd, gdb_rtt_i.offsets + 4, 4);
+    return rd != wr;
+}
+
+void gdb_rtt_poll(void)
+{
+    TickType_t interval;
+
+    if (gdb_rtt_wait() != 0) {
+        return;
+    }
+    interval = pdMS_TO_TICKS(GDB_RTT_CONFIG_POLL_MS);
+    if (gdb_rtt_i.state == gdb_rtt_state_scanning) {
+        gdb_rtt_scan();
+        /* go through the range quickly, then wait for the target */
+        if ((gdb_rtt_i.state == gdb_rtt_state_scanning) && (gdb_rtt_i.scan_next != gdb_rtt_i.scan_addr)) {
+            interval = 1;
+        }
+    } else if (gdb_rtt_drain()) {
+        /* come back as soon as the endpoint is free again */
+        interval = 1;
+    }
+    gdb_rtt_i.next = xTaskGetTickCount() + interval;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-semihost.h"
+#include "riscv-target.h"
+#include "encoding.h"
+
+#define SEMIHOST_SLLI           (0x01f01013)    /* slli x0, x0, 0x1f */
+#define SEMIHOST_EBREAK         (0x00100073)
+#define SEMIHOST_SRAI           (0x40705013)    /* srai x0, x0, 7 */
+
+#define SYS_OPEN                (0x01)
+#define SYS_CLOSE               (0x02)
+#define SYS_WRITEC              (0x03)
+#define SYS_WRITE0              (0x04)
+#define SYS_WRITE               (0x05)
+#define SYS_READ                (0x06)
+#define SYS_ISTTY               (0x09)
+#define SYS_CLOCK               (0x10)
+#define SYS_ERRNO               (0x13)
+#define SYS_EXIT                (0x18)
+
+#define ADP_STOPPED_APPLICATION_EXIT    (0x20026)
+
+/* console handles, as ''':tt''' opens them for reading, writing and appending */
+#define SEMIHOST_STDIN          (0)
+#define SEMIHOST_STDOUT         (1)
+#define SEMIHOST_STDERR         (2)
+
+/* strings are read up to these boundaries, not to run off the end of memory */
+#define SEMIHOST_STRING_CHUNK   (32)
+
+typedef struct gdb_semihost_s
+{
+    TickType_t clock_base;
+
+    uint32_t count;         /* bytes buffered */
+    TickType_t first;       /* tick the oldest of them came in */
+
+    uint64_t read_addr;
+    uint32_t read_len;
+    uint32_t exit_code;
+} gdb_semihost_t;
+
+static gdb_semihost_t gdb_semihost_i;
+static uint8_t semihost_buffer[GDB_SEMIHOST_CONFIG_BUFFER_SIZE];
+
+void gdb_semihost_init(void)
+{
+    memset(&gdb_semihost_i, 0, sizeof(gdb_semihost_i));
+    gdb_semihost_i.clock_base = xTaskGetTickCount();
+}
+
+/*
+ * The parameter block a1 points to, num fields of XLEN bits.
+ */
+static void gdb_semihost_params(uint64_t addr, uint64_t* params, uint32_t num)
+{
+    uint8_t raw[3 * sizeof(uint64_t)];
+    uint32_t size, i;
+
+    size = (rv_target_mxl() == MXL_RV32) ? 4 : 8;
+    rv_target_read_memory(raw, addr, size * num);
+    for (i = 0; i < num; i++) {
+        params[i] = 0;
+        memcpy(&params[i], &raw[i * size], size);
+    }
+}
+
+static void gdb_semihost_reserve(gdb_semihost_output_t output)
+{
+    if (gdb_semihost_i.count == GDB_SEMIHOST_CONFIG_BUFFER_SIZE) {
+        gdb_semihost_flush(output);
+    }
+    if (gdb_semihost_i.count == 0) {
+        gdb_semihost_i.first = xTaskGetTickCount();
+    }
+}
+
+static void gdb_semihost_write(uint64_t addr, uint32_t len, gdb_semihost_output_t output)
+{
+    uint32_t n;
+
+    while (len) {
+        gdb_semihost_reserve(output);
+        n = GDB_SEMIHOST_CONFIG_BUFFER_SIZE - gdb_semihost_i.count;
+        if (n > len) {
+            n = len;
+        }
+        rv_target_read_memory(&semihost_buffer[gdb_semihost_i.count], addr, n);
+        gdb_semihost_i.count += n;
+        addr += n;
+        len -= n;
+    }
+}
+
+static void gdb_semihost_write0(uint64_t addr, gdb_semihost_output_t output)
+{
+    uint8_t* p;
+    uint8_t* end;
+    uint32_t n;
+
+    for (;;) {
+        gdb_semihost_reserve(output);
+        n = SEMIHOST_STRING_CHUNK - (addr & (SEMIHOST_STRING_CHUNK - 1));
+        if (n > GDB_SEMIHOST_CONFIG_BUFFER_SIZE - gdb_semihost_i.count) {
+            n = GDB_SEMIHOST_CONFIG_BUFFER_SIZE - gdb_semihost_i.count;
+        }
+        p = &semihost_buffer[gdb_semihost_i.count];
+        rv_target_read_memory(p, addr, n);
+        end = memchr(p, 0, n);
+        if (end != NULL) {
+            gdb_semihost_i.count += end - p;
+            return;
+        }
+        gdb_semihost_i.count += n;
+        addr += n;
+    }
+}
+
+gdb_semihost_result_t gdb_semihost_call(gdb_semihost_output_t output)
+{
+    uint64_t pc = 0, op = 0, arg = 0, ret = 0;
+    uint64_t params[3];
+    uint32_t insn[3];
+    char name[4];
+
+    rv_target_read_register(&pc, RV_REG_PC);
+    rv_target_read_memory((uint8_t*)insn, pc - 4, sizeof(insn));
+    if ((insn[0] != SEMIHOST_SLLI) || (insn[1] != SEMIHOST_EBREAK) || (insn[2] != SEMIHOST_SRAI)) {
+        return gdb_semihost_result_none;
+    }
+    rv_target_read_register(&op, RV_REG_A0);
+    rv_target_read_register(&arg, RV_REG_A1);
+
+    switch ((uint32_t)op) {
+    case SYS_OPEN:
+        /* only the console, ''':tt''' */
+        gdb_semihost_params(arg, params, 3);
+        memset(name, 0, sizeof(name));
+        if (params[2] == 3) {
+            rv_target_read_memory((uint8_t*)name, params[0], 3);
+        }
+        if (strcmp(name, ":tt") != 0) {
+            ret = (uint64_t)-1;
+        } else if (params[1] < 4) {
+            ret = SEMIHOST_STDIN;
+        } else if (params[1] < 8) {
+            ret = SEMIHOST_STDOUT;
+        } else {
+            ret = SEMIHOST_STDERR;
+        }
+        break;
+    case SYS_CLOSE:
+    case SYS_ISTTY:
+        gdb_semihost_params(arg, params, 1);
+        if (params[0] <= SEMIHOST_STDERR) {
+            ret = ((uint32_t)op == SYS_ISTTY) ? 1 : 0;
+        } else {
+            ret = (uint64_t)-1;
+        }
+        break;
+    case SYS_WRITEC:
+        gdb_semihost_write(arg, 1, output);
+        break;
+    case SYS_WRITE0:
+        gdb_semihost_write0(arg, output);
+        break;
+    case SYS_WRITE:
+        /* returns the number of bytes not written */
+        gdb_semihost_params(arg, params, 3);
+        if ((params[0] == SEMIHOST_STDOUT) || (params[0] == SEMIHOST_STDERR)) {
+            gdb_semihost_write(params[1], (uint32_t)params[2], output);
+        } else {
+            ret = params[2];
+        }
+        break;
+    case SYS_READ:
+        gdb_semihost_params(arg, params, 3);
+        if ((params[0] == SEMIHOST_STDIN) && (params[2] != 0)) {
+            /* what was printed so far is likely the prompt */
+            gdb_semihost_flush(output);
+            gdb_semihost_i.read_addr = params[1];
+            gdb_semihost_i.read_len = (uint32_t)params[2];
+            return gdb_semihost_result_read;
+        }
+        ret = params[2];
+        break;
+    case SYS_CLOCK:
+        /* centiseconds since GDB connected */
+        ret = (uint64_t)(xTaskGetTickCount() - gdb_semihost_i.clock_base) * 100 / configTICK_RATE_HZ;
+        break;
+    case SYS_ERRNO:
+        break;
+    case SYS_EXIT:
+        /* the reason is in a1 itself on RV32, a1 points to it and a subcode on RV64 */
+        if (rv_target_mxl() == MXL_RV32) {
+            gdb_semihost_i.exit_code = (arg == ADP_STOPPED_APPLICATION_EXIT) ? 0 : 1;
+        } else {
+            gdb_semihost_params(arg, params, 2);
+            gdb_semihost_i.exit_code = (params[0] == ADP_STOPPED_APPLICATION_EXIT) ? (uint32_t)params[1] : 1;
+        }
+        gdb_semihost_flush(output);
+        return gdb_semihost_result_exit;
+    default:
+        return gdb_semihost_result_none;
+    }
+
+    rv_target_write_register(&ret, RV_REG_A0);
+    pc += 4;
+    rv_target_write_register(&pc, RV_REG_PC);
+    return gdb_semihost_result_resume;
+}
+
+void gdb_semihost_read_args(uint64_t* addr, uint32_t* len)
+{
+    *addr = gdb_semihost_i.read_addr;
+    *len = gdb_semihost_i.read_len;
+}
+
+void gdb_semihost_read_done(int32_t ret)
+{
+    uint64_t pc = 0, left;
+
+    /* returns the number of bytes not read, all of them on an error */
+    left = gdb_semihost_i.read_len;
+    if ((ret > 0) && ((uint32_t)ret <= gdb_semihost_i.read_len)) {
+        left -= ret;
+    }
+    rv_target_write_register(&left, RV_REG_A0);
+    rv_target_read_register(&pc, RV_REG_PC);
+    pc += 4;
+    rv_target_write_register(&pc, RV_REG_PC);
+}
+
+uint32_t gdb_semihost_exit_code(void)
+{
+    return gdb_semihost_i.exit_code;
+}
+
+void gdb_semihost_flush(gdb_semihost_output_t output)
+{
+    if (gdb_semihost_i.count != 0) {
+        output(semihost_buffer, gdb_semihost_i.count);
+        gdb_semihost_i.count = 0;
+    }
+}
+
+TickType_t gdb_semihost_wait(void)
+{
+    TickType_t now, due;
+
+    if (gdb_semihost_i.count == 0) {
+        return portMAX_DELAY;
+    }
+    now = xTaskGetTickCount();
+    due = gdb_semihost_i.first + pdMS_TO_TICKS(GDB_SEMIHOST_CONFIG_FLUSH_MS);
+    if ((int32_t)(due - now) <= 0) {
+        return 0;
+    }
+    return due - now;
+}
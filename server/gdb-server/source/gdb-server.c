@@ -15,6 +15,12 @@
  */
 
 #include "gdb-packet.h"
+#include "gdb-agent.h"
+#include "gdb-trace.h"
+#include "gdb-profile.h"
+#include "gdb-live.h"
+#include "gdb-rtt.h"
+#include "gdb-semihost.h"
 #include "riscv-target.h"
 #include "encoding.h"
 #include "flash.h"
@@ -23,20 +29,48 @@
 static gdb_packet_t cmd;
 static gdb_packet_t rsp;
 
+/* SPIFLASH_PAGE_SIZE in flash.c, streamed flash writes are cut at it */
+#define GDB_SERVER_FLASH_PAGE_SIZE      (0x100)
+
 typedef int16_t gdb_server_tid_t;
 
+/* one ‘;X’ condition of a ‘Z0’ or ‘Z1’ breakpoint, len 0 is a free entry */
+typedef struct gdb_server_cond_s
+{
+    uint64_t addr;
+    rv_target_breakpoint_type_t type;
+    uint32_t kind;
+    uint32_t len;
+    uint8_t code[GDB_SERVER_CONFIG_COND_SIZE];
+} gdb_server_cond_t;
+
 typedef struct gdb_server_s
 {
     bool target_running;
     bool gdb_connected;
     bool restore_reg_flag;
+    bool binary_upload;
+    bool semihost_read;
+    bool step_pending;
+    bool range_step;
+    bool range_next;
+    uint64_t range_start;
+    uint64_t range_end;
+    uint32_t stepi_count;
+    uint32_t poll_count;
+    TickType_t poll_interval;
     rv_target_halt_info_t halt_info;
     rv_target_error_t target_error;
 
     uint64_t mem_addr;
     uint32_t mem_len;
-    uint8_t mem_buffer[GDB_PACKET_BUFF_SIZE];
+    uint8_t *mem_buffer;
     uint32_t flash_err;
+    uint32_t spi_base_addr;
+    uint32_t flash_block_size;
+    char stream_cmd;
+    bool stream_escape;
+    uint32_t stream_len;
     uint32_t i;
     uint64_t regs[RV_TARGET_CONFIG_REG_NUM];
     uint64_t reg_tmp[4];
@@ -46,13 +80,19 @@ typedef struct gdb_server_s
     uint64_t breakpoint_addr;
     uint32_t breakpoint_kind;
     uint32_t breakpoint_err;
+    gdb_server_cond_t conds[GDB_SERVER_CONFIG_COND_NUM];
 } gdb_server_t;
 
 static gdb_server_t gdb_server_i;
 
+static const uint32_t gdb_server_expedited_regs[] = GDB_SERVER_CONFIG_EXPEDITED_REGS;
+
 void gdb_server_cmd_ctrl_c(void);
 void gdb_server_cmd_q(void);
+void gdb_server_cmd_qSupported(void);
 void gdb_server_cmd_qRcmd(void);
+void gdb_server_cmd_profile(const char* args);
+void gdb_server_cmd_rtt(const char* args);
 void gdb_server_cmd_Q(void);
 void gdb_server_cmd_g(void);
 void gdb_server_cmd_G(void);
@@ -68,18 +108,38 @@ void gdb_server_cmd_s(void);
 void gdb_server_cmd_z(void);
 void gdb_server_cmd_Z(void);
 void gdb_server_cmd_v(void);
+void gdb_server_cmd_vCont(void);
+void gdb_server_cmd_F(void);
 void gdb_server_cmd_custom(void);
 void gdb_server_cmd_custom_set(const char* data);
 void gdb_server_cmd_custom_read(const char* data);
 void gdb_server_cmd_custom_algorithm(const char* data);
+void gdb_server_cmd_custom_live(const char* data);
 
 void gdb_server_connected(void);
 void gdb_server_disconnected(void);
 
 static void gdb_server_target_run(bool run);
+static void gdb_server_poll_backoff(void);
+static void gdb_server_reply_halted(void);
+static void gdb_server_halted(void);
+static bool gdb_server_step_done(void);
+static void gdb_server_range_step(bool check);
+static void gdb_server_run_on(void);
+static void gdb_server_cond_remove(void);
+static void gdb_server_cond_insert(const char* p);
+static bool gdb_server_cond_skip(void);
+static bool gdb_server_trace_hit(void);
+static bool gdb_server_semihost(void);
+static void gdb_server_semihost_output(const uint8_t* data, uint32_t len);
+static bool gdb_server_step_over(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind);
+static bool gdb_server_stepi(uint32_t count);
 static void gdb_server_reply_ok(void);
 static void gdb_server_reply_err(int err);
 static void gdb_server_send_response(void);
+static void gdb_server_reply_stop(void);
+static void gdb_server_reply_memory(bool binary);
+static void gdb_server_stream_write(const uint8_t* xbin, uint32_t xbin_len);
 
 static void bin_to_hex(const uint8_t *bin, char *hex, uint32_t nbyte);
 static void hex_to_bin(const char *hex, uint8_t *bin, uint32_t nbyte);
@@ -87,66 +147,85 @@ static void uint32_to_hex_le(uint32_t data, char *hex);
 static void uint64_to_hex_le(uint64_t data, char *hex);
 static void hex_to_uint32_le(const char *hex, uint32_t *data);
 static void hex_to_uint64_le(const char *hex, uint64_t *data);
-static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len);
-static uint32_t bin_decode(const uint8_t* xbin, uint8_t* bin, uint32_t xbin_len);
+static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len, uint32_t xbin_size);
+static uint32_t bin_decode(const uint8_t* xbin, uint8_t* bin, uint32_t xbin_len, bool* escape);
 
 void gdb_server_init(void)
 {
     gdb_server_target_run(false);
     gdb_server_i.gdb_connected = false;
     gdb_set_no_ack_mode(false);
-    rsp.data = &rsp_buffer[2];
+    gdb_set_rle_mode(false);
+    gdb_server_i.mem_buffer = pvPortMalloc(GDB_PACKET_BUFF_SIZE);
+    gdb_rsp_packet_acquire(&rsp);
 }
 
 void gdb_server_poll(void)
 {
     char c;
     BaseType_t xReturned;
+    TickType_t wait;
     uint32_t ret, len;
 
     for (;;) {
         if (gdb_server_i.gdb_connected && gdb_server_i.target_running) {
-            xReturned = xQueueReceive(gdb_cmd_packet_xQueue, &cmd, (100 / portTICK_PERIOD_MS));
+            /* wake up in time for the next PC sample */
+            wait = gdb_profile_wait();
+            if (wait > gdb_live_wait()) {
+                wait = gdb_live_wait();
+            }
+            if (wait > gdb_rtt_wait()) {
+                wait = gdb_rtt_wait();
+            }
+            if (wait > gdb_semihost_wait()) {
+                wait = gdb_semihost_wait();
+            }
+            if (wait > gdb_server_i.poll_interval) {
+                wait = gdb_server_i.poll_interval;
+            }
+            xReturned = xQueueReceive(gdb_cmd_packet_xQueue, &cmd, wait);
             if (xReturned == pdPASS) {
                 if (*cmd.data == '\x03' && cmd.len == 1) {
                     gdb_server_cmd_ctrl_c();
                     gdb_server_target_run(false);
+                    gdb_semihost_flush(gdb_server_semihost_output);
                     strncpy(rsp.data, "T02", GDB_PACKET_BUFF_SIZE);
                     rsp.len = 3;
-                    gdb_server_send_response();
+                    gdb_server_reply_stop();
+                } else if (strncmp(cmd.data, "+:live:", 7) == 0) {
+                    /* the point of live watch is to drain it while the target runs */
+                    gdb_server_cmd_custom();
                 }
+                gdb_cmd_packet_release(&cmd);
             }
 
-            if (gdb_server_i.target_running) {
+            if (gdb_server_i.target_running && gdb_server_i.range_next) {
+                /* a halt inside the ‘vCont;r’ range was dealt with, step on */
+                gdb_server_range_step(true);
+            } else if (gdb_server_i.target_running) {
                 rv_target_halt_check(&gdb_server_i.halt_info);
-                if (gdb_server_i.halt_info.reason != rv_target_halt_reason_running) {
-                    gdb_server_target_run(false);
-                    if (gdb_server_i.restore_reg_flag) {
-                        /* Restore registers */
-                        rv_target_write_core_registers(gdb_server_i.regs);
-                        gdb_server_i.restore_reg_flag = false;
-                    }
-                    if (gdb_server_i.halt_info.reason == rv_target_halt_reason_other) {
-                        strncpy(rsp.data, "T05", GDB_PACKET_BUFF_SIZE);
-                    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_write_watchpoint) {
-                        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05watch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
-                    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_read_watchpoint) {
-                        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05rwatch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
-                    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_access_watchpoint) {
-                        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05awatch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
-                    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_hardware_breakpoint) {
-                        strncpy(rsp.data, "T05hwbreak:;", GDB_PACKET_BUFF_SIZE);
-                    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_software_breakpoint) {
-                        strncpy(rsp.data, "T05swbreak:;", GDB_PACKET_BUFF_SIZE);
+                if (gdb_server_i.halt_info.reason == rv_target_halt_reason_running) {
+                    gdb_live_poll();
+                    gdb_rtt_poll();
+                }
+                if ((gdb_server_i.halt_info.reason == rv_target_halt_reason_running) && !gdb_profile_poll()) {
+                    /* it halted on its own while being sampled */
+                    rv_target_halt_check(&gdb_server_i.halt_info);
+                }
+                if (gdb_server_i.halt_info.reason == rv_target_halt_reason_running) {
+                    if (gdb_semihost_wait() == 0) {
+                        gdb_semihost_flush(gdb_server_semihost_output);
                     }
-                    rsp.len = strlen(rsp.data);
-                    gdb_server_send_response();
+                    gdb_server_poll_backoff();
+                } else {
+                    gdb_server_halted();
                 }
             }
         } else {
             xReturned = xQueueReceive(gdb_cmd_packet_xQueue, &cmd, portMAX_DELAY);
             if (xReturned == pdPASS) {
-                c = *cmd.data;
+                /* later fragments of a streamed packet go to the same handler */
+                c = (cmd.flags & GDB_PACKET_FLAG_FIRST) ? *cmd.data : gdb_server_i.stream_cmd;
                 if (c == 'q') {
                     gdb_server_cmd_q();
                 } else if (c == 'Q') {
@@ -179,9 +258,12 @@ void gdb_server_poll(void)
                     gdb_server_cmd_Z();
                 } else if (c == 'v') {
                     gdb_server_cmd_v();
+                } else if (c == 'F') {
+                    gdb_server_cmd_F();
                 } else if (c == '+') {
                     gdb_server_cmd_custom();
                 }
+                gdb_cmd_packet_release(&cmd);
             }
         }
     }
@@ -192,7 +274,17 @@ void gdb_server_poll(void)
  */
 void gdb_server_cmd_ctrl_c(void)
 {
+    uint32_t i;
+
     rv_target_halt();
+    /* wait for the hart so the stop reply can carry its registers */
+    for (i = 0; i < 10; i++) {
+        rv_target_halt_check(&gdb_server_i.halt_info);
+        if (gdb_server_i.halt_info.reason != rv_target_halt_reason_running) {
+            break;
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
 }
 
 /*
@@ -201,11 +293,36 @@ void gdb_server_cmd_ctrl_c(void)
  */
 void gdb_server_cmd_q(void)
 {
-    if (strncmp(cmd.data, "qRcmd,", 6) == 0) {
+    if (strncmp(cmd.data, "qSupported", 10) == 0) {
+        gdb_server_cmd_qSupported();
+    } else if (strncmp(cmd.data, "qRcmd,", 6) == 0) {
         gdb_server_cmd_qRcmd();
+    } else if (strncmp(cmd.data, "qT", 2) == 0) {
+        rsp.len = gdb_trace_command(cmd.data, rsp.data, GDB_PACKET_BUFF_SIZE);
+        gdb_server_send_response();
     }
 }
 
+/*
+ * ‘qSupported [:gdbfeature [;gdbfeature]… ]’
+ * Tell the remote stub about features supported by GDB, and query the stub
+ * for features it supports.
+ */
+void gdb_server_cmd_qSupported(void)
+{
+    /* ‘x’ replies carry the ‘b’ prefix only once GDB asked for it */
+    gdb_server_i.binary_upload = (strstr(cmd.data, "binary-upload+") != NULL);
+    /* a GDB that sends qSupported expands ‘*’ runs, the reply itself may use them */
+    gdb_set_rle_mode(true);
+
+    rsp.len = snprintf(rsp.data, GDB_PACKET_BUFF_SIZE,
+                       "PacketSize=%x;QStartNoAckMode+;swbreak+;hwbreak+;ConditionalBreakpoints+;"
+                       "ConditionalTracepoints+;EnableDisableTracepoints+;tracenz+%s",
+                       GDB_PACKET_BUFF_SIZE,
+                       gdb_server_i.binary_upload ? ";binary-upload+" : "");
+    gdb_server_send_response();
+}
+
 /*
  * ‘qRcmd,command’
  * command (hex encoded) is passed to the local interpreter for execution.
@@ -230,6 +347,26 @@ void gdb_server_cmd_qRcmd(void)
         rv_target_halt();
         rv_target_init_after_halted(&gdb_server_i.target_error);
         gdb_server_reply_ok();
+    } else if (strncmp((char*)gdb_server_i.mem_buffer, "stepi", 5) == 0) {
+        /*
+         * Run by the next ‘s’: GDB then gets a stop reply for it and reads
+         * the registers again, which it would not after a monitor command.
+         */
+        if ((sscanf((char*)&gdb_server_i.mem_buffer[5], "%u", (unsigned int*)&len) != 1) || (len == 0)) {
+            len = 1;
+        }
+        gdb_server_i.stepi_count = len;
+        len = snprintf((char*)gdb_server_i.mem_buffer, (GDB_PACKET_BUFF_SIZE - 1) / 2,
+                       "the next stepi runs %u instructions\n", (unsigned int)len);
+        rsp.data[0] = 'O';
+        bin_to_hex(gdb_server_i.mem_buffer, &rsp.data[1], len);
+        rsp.len = 1 + len * 2;
+        gdb_server_send_response();
+        gdb_server_reply_ok();
+    } else if (strncmp((char*)gdb_server_i.mem_buffer, "profile", 7) == 0) {
+        gdb_server_cmd_profile((char*)&gdb_server_i.mem_buffer[7]);
+    } else if (strncmp((char*)gdb_server_i.mem_buffer, "rtt", 3) == 0) {
+        gdb_server_cmd_rtt((char*)&gdb_server_i.mem_buffer[3]);
     } else {
         bin_to_hex((uint8_t*)unspported_monitor_command, rsp.data, sizeof(unspported_monitor_command) - 1);
         rsp.len = (sizeof(unspported_monitor_command) - 1) * 2;
@@ -237,6 +374,75 @@ void gdb_server_cmd_qRcmd(void)
     }
 }
 
+/*
+ * ‘monitor profile start low high [rate]’, ‘monitor profile stop’,
+ * ‘monitor profile dump’
+ * PC sampling while the target runs, addresses in hex, rate in samples per
+ * second. The dump is printed on the GDB console.
+ */
+void gdb_server_cmd_profile(const char* args)
+{
+    uint32_t low, high, rate, index, len;
+    char* text;
+
+    while (*args == ' ') {
+        args++;
+    }
+    if (strncmp(args, "start", 5) == 0) {
+        rate = GDB_PROFILE_CONFIG_RATE_HZ;
+        if (sscanf(&args[5], "%x %x %u", (unsigned int*)&low, (unsigned int*)&high, (unsigned int*)&rate) < 2) {
+            gdb_server_reply_err(1);
+            return;
+        }
+        gdb_profile_start(low, high, rate);
+    } else if (strncmp(args, "stop", 4) == 0) {
+        gdb_profile_stop();
+    } else if (strncmp(args, "dump", 4) == 0) {
+        /* mem_buffer holds the command, it is done with it */
+        text = (char*)gdb_server_i.mem_buffer;
+        index = 0;
+        while ((len = gdb_profile_dump(&index, text, (GDB_PACKET_BUFF_SIZE - 1) / 2)) != 0) {
+            rsp.data[0] = 'O';
+            bin_to_hex((uint8_t*)text, &rsp.data[1], len);
+            rsp.len = 1 + len * 2;
+            gdb_server_send_response();
+        }
+    } else {
+        gdb_server_reply_err(1);
+        return;
+    }
+    gdb_server_reply_ok();
+}
+
+/*
+ * ‘monitor rtt start [addr size]’, ‘monitor rtt stop’
+ * Look for an RTT control block in the range, in hex, and stream its
+ * up-buffer 0 to the second CDC interface while the target runs.
+ */
+void gdb_server_cmd_rtt(const char* args)
+{
+    uint32_t addr, size;
+
+    while (*args == ' ') {
+        args++;
+    }
+    if (strncmp(args, "start", 5) == 0) {
+        addr = GDB_RTT_CONFIG_SCAN_ADDR;
+        size = GDB_RTT_CONFIG_SCAN_SIZE;
+        if ((sscanf(&args[5], "%x %x", (unsigned int*)&addr, (unsigned int*)&size) == 1) ||
+            !gdb_rtt_start(addr, size)) {
+            gdb_server_reply_err(1);
+            return;
+        }
+    } else if (strncmp(args, "stop", 4) == 0) {
+        gdb_rtt_stop();
+    } else {
+        gdb_server_reply_err(1);
+        return;
+    }
+    gdb_server_reply_ok();
+}
+
 /*
  * ‘Q name params...’
  * General query (‘q’) and set (‘Q’).
@@ -246,6 +452,9 @@ void gdb_server_cmd_Q(void)
     if (strncmp(cmd.data, "QStartNoAckMode", 15) == 0) {
         gdb_server_reply_ok();
         gdb_set_no_ack_mode(true);
+    } else if (strncmp(cmd.data, "QT", 2) == 0) {
+        rsp.len = gdb_trace_command(cmd.data, rsp.data, GDB_PACKET_BUFF_SIZE);
+        gdb_server_send_response();
     }
 }
 
@@ -256,8 +465,13 @@ void gdb_server_cmd_Q(void)
 void gdb_server_cmd_g(void)
 {
     int i;
+    bool collected = true;
 
-    rv_target_read_core_registers(gdb_server_i.regs);
+    if (gdb_trace_frame_selected()) {
+        collected = gdb_trace_frame_registers(gdb_server_i.regs);
+    } else {
+        rv_target_read_core_registers(gdb_server_i.regs);
+    }
 
     for(i = 0; i < RV_TARGET_CONFIG_REG_NUM; i++) {
         if (MXL_RV32 == rv_target_mxl()) {
@@ -271,6 +485,10 @@ void gdb_server_cmd_g(void)
     } else if (MXL_RV64 == rv_target_mxl()) {
         rsp.len = MXL_RV64 * 8 * RV_TARGET_CONFIG_REG_NUM;
     }
+    if (!collected) {
+        /* a trace frame without registers: all but the pc are unavailable */
+        memset(rsp.data, 'x', RV_REG_PC * rv_target_mxl() * 8);
+    }
     gdb_server_send_response();
 }
 
@@ -312,6 +530,7 @@ void gdb_server_cmd_k(void)
  */
 void gdb_server_cmd_c(void)
 {
+    gdb_server_i.stepi_count = 0;
     rv_target_resume();
     gdb_server_target_run(true);
 }
@@ -329,8 +548,26 @@ void gdb_server_cmd_m(void)
     p++;
     sscanf(&cmd.data[1], "%x", (unsigned int*)(&gdb_server_i.mem_addr));
     sscanf(p, "%x", (unsigned int*)(&gdb_server_i.mem_len));
-    if (gdb_server_i.mem_len > sizeof(gdb_server_i.mem_buffer)) {
-        gdb_server_i.mem_len = sizeof(gdb_server_i.mem_buffer);
+    /* two hex digits per byte in the reply */
+    if (gdb_server_i.mem_len > GDB_PACKET_BUFF_SIZE / 2) {
+        gdb_server_i.mem_len = GDB_PACKET_BUFF_SIZE / 2;
+    }
+
+    if (gdb_trace_frame_selected()) {
+        gdb_server_i.mem_len = gdb_trace_frame_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
+        if (gdb_server_i.mem_len == 0) {
+            gdb_server_reply_err(1);
+            return;
+        }
+        bin_to_hex(gdb_server_i.mem_buffer, rsp.data, gdb_server_i.mem_len);
+        rsp.len = gdb_server_i.mem_len * 2;
+        gdb_server_send_response();
+        return;
+    }
+
+    if (gdb_get_no_ack_mode()) {
+        gdb_server_reply_memory(false);
+        return;
     }
 
     rv_target_read_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
@@ -352,8 +589,8 @@ void gdb_server_cmd_M(void)
     p = strchr(&cmd.data[1], ':');
     p++;
 
-    if (gdb_server_i.mem_len > sizeof(gdb_server_i.mem_buffer)) {
-        gdb_server_i.mem_len = sizeof(gdb_server_i.mem_buffer);
+    if (gdb_server_i.mem_len > GDB_PACKET_BUFF_SIZE) {
+        gdb_server_i.mem_len = GDB_PACKET_BUFF_SIZE;
     }
 
     hex_to_bin(p, gdb_server_i.mem_buffer, gdb_server_i.mem_len);
@@ -375,13 +612,29 @@ void gdb_server_cmd_x(void)
     p++;
     sscanf(&cmd.data[1], "%x", (unsigned int*)(&gdb_server_i.mem_addr));
     sscanf(p, "%x", (unsigned int*)(&gdb_server_i.mem_len));
-    if (gdb_server_i.mem_len > sizeof(gdb_server_i.mem_buffer)) {
-        gdb_server_i.mem_len = sizeof(gdb_server_i.mem_buffer);
+    if (gdb_server_i.mem_len > GDB_PACKET_BUFF_SIZE) {
+        gdb_server_i.mem_len = GDB_PACKET_BUFF_SIZE;
     }
 
-    rv_target_read_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
+    if (gdb_trace_frame_selected()) {
+        gdb_server_i.mem_len = gdb_trace_frame_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
+        if (gdb_server_i.mem_len == 0) {
+            gdb_server_reply_err(1);
+            return;
+        }
+    } else if (gdb_get_no_ack_mode()) {
+        gdb_server_reply_memory(true);
+        return;
+    } else {
+        rv_target_read_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
+    }
 
-    rsp.len = bin_encode(rsp.data, gdb_server_i.mem_buffer, gdb_server_i.mem_len);;
+    if (gdb_server_i.binary_upload) {
+        rsp.data[0] = 'b';
+        rsp.len = 1 + bin_encode(&rsp.data[1], gdb_server_i.mem_buffer, gdb_server_i.mem_len, gdb_server_i.mem_len);
+    } else {
+        rsp.len = bin_encode(rsp.data, gdb_server_i.mem_buffer, gdb_server_i.mem_len, gdb_server_i.mem_len);
+    }
     gdb_server_send_response();
 }
 
@@ -393,6 +646,12 @@ void gdb_server_cmd_X(void)
 {
     const char *p;
     uint32_t length;
+    bool escape = false;
+
+    if (!(cmd.flags & GDB_PACKET_FLAG_FIRST)) {
+        gdb_server_stream_write(cmd.data, cmd.len);
+        return;
+    }
 
     sscanf(&cmd.data[1], "%x,%x", &gdb_server_i.mem_addr, &gdb_server_i.mem_len);
     if (gdb_server_i.mem_len == 0) {
@@ -402,13 +661,22 @@ void gdb_server_cmd_X(void)
 
     p = strchr(&cmd.data[1], ':');
     p++;
+    length = cmd.len - ((uint32_t)p - (uint32_t)cmd.data);
 
-    if (gdb_server_i.mem_len > sizeof(gdb_server_i.mem_buffer)) {
-        gdb_server_i.mem_len = sizeof(gdb_server_i.mem_buffer);
+    if (!(cmd.flags & GDB_PACKET_FLAG_LAST)) {
+        gdb_server_i.stream_cmd = 'X';
+        gdb_server_i.stream_escape = false;
+        gdb_server_i.stream_len = 0;
+        gdb_server_i.flash_err = 0;
+        gdb_server_stream_write((const uint8_t*)p, length);
+        return;
     }
 
-    length = cmd.len - ((uint32_t)p - (uint32_t)cmd.data);
-    bin_decode((uint8_t*)p, gdb_server_i.mem_buffer, length);
+    if (gdb_server_i.mem_len > GDB_PACKET_BUFF_SIZE) {
+        gdb_server_i.mem_len = GDB_PACKET_BUFF_SIZE;
+    }
+
+    bin_decode((uint8_t*)p, gdb_server_i.mem_buffer, length, &escape);
 
     rv_target_write_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, gdb_server_i.mem_len);
 
@@ -423,6 +691,21 @@ void gdb_server_cmd_p(void)
 {
     sscanf(&cmd.data[1], "%x", &gdb_server_i.reg_tmp_num);
 
+    if (gdb_trace_frame_selected()) {
+        /* only the core registers can be in a trace frame */
+        rsp.len = rv_target_mxl() * 8;
+        if ((gdb_server_i.reg_tmp_num > RV_REG_PC) ||
+            (!gdb_trace_frame_registers(gdb_server_i.regs) && (gdb_server_i.reg_tmp_num != RV_REG_PC))) {
+            memset(rsp.data, 'x', rsp.len);
+        } else if (MXL_RV32 == rv_target_mxl()) {
+            uint32_to_hex_le(*(((uint32_t*)gdb_server_i.regs) + gdb_server_i.reg_tmp_num), rsp.data);
+        } else {
+            uint64_to_hex_le(gdb_server_i.regs[gdb_server_i.reg_tmp_num], rsp.data);
+        }
+        gdb_server_send_response();
+        return;
+    }
+
     rv_target_read_register(gdb_server_i.reg_tmp, gdb_server_i.reg_tmp_num);
     if ((gdb_server_i.reg_tmp_num >= RV_REG_V0) && (gdb_server_i.reg_tmp_num <= RV_REG_V31)) {
         uint32_t data_bits = rv_target_vlenb() * 8;
@@ -490,11 +773,28 @@ void gdb_server_cmd_P(void)
 /*
  * ‘s [addr]’
  * Single step, resuming at addr. If addr is omitted, resume at same address.
+ * After ‘monitor stepi N’ this one step runs N instructions.
  */
 void gdb_server_cmd_s(void)
 {
-    rv_target_step();
-    gdb_server_target_run(true);
+    uint32_t count = gdb_server_i.stepi_count;
+
+    if (count) {
+        gdb_server_i.stepi_count = 0;
+        if (gdb_server_stepi(count)) {
+            gdb_server_reply_halted();
+        } else {
+            gdb_server_reply_err(1);
+        }
+        return;
+    }
+    /* a step is normally done by the time dmstatus is read, answer at once */
+    if (rv_target_step_wait()) {
+        rv_target_halt_check(&gdb_server_i.halt_info);
+        gdb_server_reply_halted();
+    } else {
+        gdb_server_target_run(true);
+    }
 }
 
 /*
@@ -505,9 +805,11 @@ void gdb_server_cmd_s(void)
 void gdb_server_cmd_z(void)
 {
     sscanf(cmd.data, "z%x,%x,%x", &gdb_server_i.breakpoint_type, &gdb_server_i.breakpoint_addr, &gdb_server_i.breakpoint_kind);
+    gdb_server_cond_remove();
 
     rv_target_remove_breakpoint(
-            gdb_server_i.breakpoint_type, gdb_server_i.breakpoint_addr, gdb_server_i.breakpoint_kind, &gdb_server_i.breakpoint_err);
+            gdb_server_i.breakpoint_type, gdb_server_i.breakpoint_addr, gdb_server_i.breakpoint_kind,
+            RV_TARGET_BREAKPOINT_OWNER_GDB, &gdb_server_i.breakpoint_err);
     if (gdb_server_i.breakpoint_err == 0) {
         gdb_server_reply_ok();
     } else {
@@ -516,19 +818,25 @@ void gdb_server_cmd_z(void)
 }
 
 /*
- * ‘Z type,addr,kind’
+ * ‘Z type,addr,kind[;cond_list…]’
  * Insert (‘Z’) or remove (‘z’) a type breakpoint or watchpoint starting at address
- * address of kind kind.
+ * address of kind kind. GDB sends ‘Z’ again when the conditions change,
+ * without a ‘z’ first.
  */
 void gdb_server_cmd_Z(void)
 {
     sscanf(cmd.data, "Z%x,%x,%x", &gdb_server_i.breakpoint_type, &gdb_server_i.breakpoint_addr, &gdb_server_i.breakpoint_kind);
+    gdb_server_cond_remove();
+    gdb_server_cond_insert(strchr(cmd.data, ';'));
 
     rv_target_insert_breakpoint(
-            gdb_server_i.breakpoint_type, gdb_server_i.breakpoint_addr, gdb_server_i.breakpoint_kind, &gdb_server_i.breakpoint_err);
+            gdb_server_i.breakpoint_type, gdb_server_i.breakpoint_addr, gdb_server_i.breakpoint_kind,
+            RV_TARGET_BREAKPOINT_OWNER_GDB, &gdb_server_i.breakpoint_err);
     if (gdb_server_i.breakpoint_err == 0) {
         gdb_server_reply_ok();
     } else {
+        /* no breakpoint, nothing to check conditions for */
+        gdb_server_cond_remove();
         gdb_server_reply_err(gdb_server_i.breakpoint_err);
     }
 }
@@ -540,28 +848,116 @@ void gdb_server_cmd_Z(void)
 void gdb_server_cmd_v(void)
 {
     const char *p;
-    static uint32_t spi_base_addr;
-    static uint32_t flash_block_size;
     uint32_t parameter[2];
+    bool escape = false;
+
+    if (!(cmd.flags & GDB_PACKET_FLAG_FIRST)) {
+        gdb_server_stream_write(cmd.data, cmd.len);
+        return;
+    }
+
+    if (strncmp(cmd.data, "vCont", 5) == 0) {
+        gdb_server_cmd_vCont();
+        return;
+    }
+
     if (strncmp(cmd.data, "vFlashInit:", 11) == 0) {
-        sscanf(cmd.data, "vFlashInit:%x,%x;", &spi_base_addr, &flash_block_size);
-        flash_init(spi_base_addr);
+        sscanf(cmd.data, "vFlashInit:%x,%x;", &gdb_server_i.spi_base_addr, &gdb_server_i.flash_block_size);
+        flash_init(gdb_server_i.spi_base_addr);
     } else if (strncmp(cmd.data, "vFlashErase:", 12) == 0) {
         sscanf(cmd.data, "vFlashErase:%x,%x;", &parameter[0], &parameter[1]);
-        flash_erase(spi_base_addr, parameter[0], parameter[0] + parameter[1]);
+        flash_erase(gdb_server_i.spi_base_addr, parameter[0], parameter[0] + parameter[1]);
     } else if (strncmp(cmd.data, "vFlashWrite:", 12) == 0) {
         sscanf(cmd.data, "vFlashWrite:%x:", &parameter[0]);
         p = strchr(&cmd.data[12], ':');
         p++;
         parameter[1] = cmd.len - ((uint32_t)p - (uint32_t)cmd.data);
-        gdb_server_i.mem_len = bin_decode((uint8_t*)p, gdb_server_i.mem_buffer, parameter[1]);
+        if (!(cmd.flags & GDB_PACKET_FLAG_LAST)) {
+            gdb_server_i.stream_cmd = 'v';
+            gdb_server_i.stream_escape = false;
+            gdb_server_i.stream_len = 0;
+            gdb_server_i.mem_addr = parameter[0];
+            gdb_server_i.flash_err = 0;
+            gdb_server_stream_write((const uint8_t*)p, parameter[1]);
+            return;
+        }
+        gdb_server_i.mem_len = bin_decode((uint8_t*)p, gdb_server_i.mem_buffer, parameter[1], &escape);
 
-        flash_write(spi_base_addr, gdb_server_i.mem_buffer, parameter[0], gdb_server_i.mem_len);
+        flash_write(gdb_server_i.spi_base_addr, gdb_server_i.mem_buffer, parameter[0], gdb_server_i.mem_len);
     } else if (strncmp(cmd.data, "vFlashDone", 10) == 0) {
     }
     gdb_server_reply_ok();
 }
 
+/*
+ * ‘vCont[;action[:thread-id]]...’
+ * Resume the inferior, only the first action is used as there is one hart.
+ * ‘r start,end’ steps on the probe while pc stays in [start,end) and only
+ * the final stop is reported.
+ */
+void gdb_server_cmd_vCont(void)
+{
+    uint32_t start, end;
+
+    if (cmd.data[5] == '?') {
+        strncpy(rsp.data, "vCont;c;C;s;S;r", GDB_PACKET_BUFF_SIZE);
+        rsp.len = strlen(rsp.data);
+        gdb_server_send_response();
+        return;
+    }
+    if (cmd.data[5] != ';') {
+        gdb_server_reply_err(1);
+        return;
+    }
+
+    switch (cmd.data[6]) {
+    case 'c':
+    case 'C':
+        gdb_server_cmd_c();
+        break;
+    case 's':
+    case 'S':
+        gdb_server_cmd_s();
+        break;
+    case 'r':
+        sscanf(&cmd.data[7], "%x,%x", &start, &end);
+        gdb_server_i.range_start = start;
+        gdb_server_i.range_end = end;
+        gdb_server_i.range_step = true;
+        /* always one step, even if pc is not in the range */
+        gdb_server_range_step(false);
+        break;
+    default:
+        gdb_server_reply_err(1);
+        break;
+    }
+}
+
+/*
+ * ‘Fretcode,errno,Ctrl-C flag;call-specific attachment’
+ * GDB answers the ‘Fread’ of a semihosting console read. The data is
+ * already in target memory.
+ */
+void gdb_server_cmd_F(void)
+{
+    int32_t ret = -1;
+
+    if (!gdb_server_i.semihost_read) {
+        return;
+    }
+    gdb_server_i.semihost_read = false;
+    sscanf(&cmd.data[1], "%x", (unsigned int*)&ret);
+    gdb_semihost_read_done(ret);
+    if (strstr(cmd.data, ",C") != NULL) {
+        /* interrupted while waiting for input, stop as after Ctrl-C */
+        strncpy(rsp.data, "T02", GDB_PACKET_BUFF_SIZE);
+        rsp.len = 3;
+        gdb_server_reply_stop();
+        return;
+    }
+    gdb_server_run_on();
+}
+
 /*
  * ‘+’
  * Packets starting with ‘+’ custom command.
@@ -578,6 +974,8 @@ void gdb_server_cmd_custom(void)
         gdb_server_cmd_custom_read(p);
     } else if (strncmp(p, "algorithm", strlen("algorithm")) == 0) {
         gdb_server_cmd_custom_algorithm(p);
+    } else if (strncmp(p, "live", strlen("live")) == 0) {
+        gdb_server_cmd_custom_live(p);
     }
 }
 
@@ -667,13 +1065,62 @@ void gdb_server_cmd_custom_algorithm(const char* data)
     gdb_server_send_response();
 }
 
+/*
+ * ‘+:live:add:addr,size;’, ‘+:live:clear;’, ‘+:live:start:rate;’,
+ * ‘+:live:stop;’, ‘+:live:read;’
+ * Live watch, numbers in hex like the other custom commands. ‘read’ is also
+ * served while the target runs and replies ‘-:live:read:dropped,count:...;’.
+ */
+void gdb_server_cmd_custom_live(const char* data)
+{
+    const char *p;
+    uint32_t addr, size, rate;
+    bool ok = true;
+
+    p = strchr(data, ':') + 1;
+    if (strncmp(p, "read", strlen("read")) == 0) {
+        strncpy(rsp.data, "-:live:read:", 12);
+        rsp.len = 12;
+        rsp.len += gdb_live_read(&rsp.data[rsp.len], GDB_PACKET_BUFF_SIZE - rsp.len - 1);
+        rsp.data[rsp.len++] = ';';
+        gdb_server_send_response();
+        return;
+    } else if (strncmp(p, "add", strlen("add")) == 0) {
+        ok = (sscanf(p, "add:%x,%x;", &addr, &size) == 2) && gdb_live_add(addr, size);
+    } else if (strncmp(p, "clear", strlen("clear")) == 0) {
+        gdb_live_clear();
+    } else if (strncmp(p, "start", strlen("start")) == 0) {
+        ok = (sscanf(p, "start:%x;", &rate) == 1) && gdb_live_start(rate);
+    } else if (strncmp(p, "stop", strlen("stop")) == 0) {
+        gdb_live_stop();
+    } else {
+        return;
+    }
+    rsp.len = snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "-:live:%.*s:%s;",
+                       (int)(strcspn(p, ":;")), p, ok ? "OK" : "ERR");
+    gdb_server_send_response();
+}
+
 void gdb_server_connected(void)
 {
     gdb_server_i.target_error = rv_target_error_none;
     gdb_server_i.gdb_connected = true;
     gdb_server_target_run(false);
     gdb_set_no_ack_mode(false);
+    gdb_set_rle_mode(false);
     gdb_server_i.restore_reg_flag = false;
+    gdb_server_i.binary_upload = false;
+    memset(gdb_server_i.conds, 0, sizeof(gdb_server_i.conds));
+    gdb_trace_init();
+    gdb_profile_stop();
+    gdb_live_clear();
+    gdb_rtt_stop();
+    gdb_semihost_init();
+    gdb_server_i.semihost_read = false;
+    gdb_server_i.step_pending = false;
+    gdb_server_i.range_step = false;
+    gdb_server_i.range_next = false;
+    gdb_server_i.stepi_count = 0;
 
     rv_target_init();
     rv_target_init_post(&gdb_server_i.target_error);
@@ -709,6 +1156,15 @@ void gdb_server_connected(void)
 
 void gdb_server_disconnected(void)
 {
+    if (gdb_server_i.target_error != rv_target_error_line) {
+        /* tracepoints GDB did not stop come out too, from a halted hart */
+        if (gdb_server_i.target_running && gdb_trace_running()) {
+            gdb_server_cmd_ctrl_c();
+            gdb_server_target_run(false);
+        }
+        gdb_trace_init();
+    }
+
     if (gdb_server_i.target_running == false) {
         if (gdb_server_i.target_error != rv_target_error_line) {
             rv_target_resume();
@@ -730,6 +1186,372 @@ void gdb_server_disconnected(void)
 static void gdb_server_target_run(bool run)
 {
     gdb_server_i.target_running = run;
+    /* most runs after a step or breakpoint continue end right away */
+    gdb_server_i.poll_count = 0;
+    gdb_server_i.poll_interval = 0;
+}
+
+/*
+ * Still running: spin for GDB_SERVER_CONFIG_POLL_SPIN polls, then wait
+ * between polls, twice as long each time up to GDB_SERVER_CONFIG_POLL_MAX_MS.
+ */
+static void gdb_server_poll_backoff(void)
+{
+    if (gdb_server_i.poll_count < GDB_SERVER_CONFIG_POLL_SPIN) {
+        gdb_server_i.poll_count++;
+    } else if (gdb_server_i.poll_interval == 0) {
+        gdb_server_i.poll_interval = 1;
+    } else if (gdb_server_i.poll_interval < (GDB_SERVER_CONFIG_POLL_MAX_MS / portTICK_PERIOD_MS)) {
+        gdb_server_i.poll_interval *= 2;
+    }
+}
+
+/*
+ * ‘monitor stepi N’: run N instructions, in RV_TARGET_ICOUNT_MAX sized runs
+ * of an icount trigger where the hart has one, else one step at a time.
+ * Ends early at a breakpoint. Returns false if a run did not halt in time
+ * and had to be halted, or a step did not end.
+ */
+static bool gdb_server_stepi(uint32_t count)
+{
+    uint32_t n, i;
+
+    while (count) {
+        n = (count > RV_TARGET_ICOUNT_MAX) ? RV_TARGET_ICOUNT_MAX : count;
+        if (rv_target_step_count(n)) {
+            for (i = 0; i < GDB_SERVER_CONFIG_STEPI_TIMEOUT_MS; i++) {
+                rv_target_halt_check(&gdb_server_i.halt_info);
+                if (gdb_server_i.halt_info.reason != rv_target_halt_reason_running) {
+                    break;
+                }
+                vTaskDelay(1 / portTICK_PERIOD_MS);
+            }
+            if (i == GDB_SERVER_CONFIG_STEPI_TIMEOUT_MS) {
+                gdb_server_cmd_ctrl_c();
+                return false;
+            }
+        } else {
+            n = 1;
+            if (!rv_target_step_wait()) {
+                gdb_server_cmd_ctrl_c();
+                return false;
+            }
+            rv_target_halt_check(&gdb_server_i.halt_info);
+        }
+        if (gdb_server_i.halt_info.reason != rv_target_halt_reason_other) {
+            return true;
+        }
+        count -= n;
+    }
+    return true;
+}
+
+/*
+ * The hart halted while running for GDB: deal with what the probe handles on
+ * its own, report the rest.
+ */
+static void gdb_server_halted(void)
+{
+    if (!gdb_server_step_done() && !gdb_server_semihost() &&
+        !gdb_server_trace_hit() && !gdb_server_cond_skip()) {
+        gdb_server_reply_halted();
+    }
+}
+
+/*
+ * The hart halted after ‘c’ or ‘s’: report why, with the expedited registers.
+ */
+static void gdb_server_reply_halted(void)
+{
+    gdb_server_target_run(false);
+    /* output still buffered comes before the stop */
+    gdb_semihost_flush(gdb_server_semihost_output);
+    if (gdb_server_i.restore_reg_flag) {
+        /* Restore registers */
+        rv_target_write_core_registers(gdb_server_i.regs);
+        gdb_server_i.restore_reg_flag = false;
+    }
+    if (gdb_server_i.halt_info.reason == rv_target_halt_reason_other) {
+        strncpy(rsp.data, "T05", GDB_PACKET_BUFF_SIZE);
+    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_write_watchpoint) {
+        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05watch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
+    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_read_watchpoint) {
+        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05rwatch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
+    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_access_watchpoint) {
+        snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "T05awatch:%x;", (unsigned int)gdb_server_i.halt_info.addr);
+    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_hardware_breakpoint) {
+        strncpy(rsp.data, "T05hwbreak:;", GDB_PACKET_BUFF_SIZE);
+    } else if (gdb_server_i.halt_info.reason == rv_target_halt_reason_software_breakpoint) {
+        strncpy(rsp.data, "T05swbreak:;", GDB_PACKET_BUFF_SIZE);
+    }
+    rsp.len = strlen(rsp.data);
+    gdb_server_reply_stop();
+}
+
+/*
+ * Drop the conditions of the breakpoint in gdb_server_i.breakpoint_*.
+ */
+static void gdb_server_cond_remove(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < GDB_SERVER_CONFIG_COND_NUM; i++) {
+        if ((gdb_server_i.conds[i].type == gdb_server_i.breakpoint_type) &&
+            (gdb_server_i.conds[i].addr == gdb_server_i.breakpoint_addr)) {
+            gdb_server_i.conds[i].len = 0;
+        }
+    }
+}
+
+/*
+ * Keep the ‘;X len,expr’ conditions that follow a ‘Z0’ or ‘Z1’. If one of
+ * them does not fit, none are kept and the breakpoint always stops, GDB
+ * checks the condition again on its side anyway.
+ */
+static void gdb_server_cond_insert(const char* p)
+{
+    uint32_t i, len;
+
+    if ((gdb_server_i.breakpoint_type != rv_target_breakpoint_type_software) &&
+        (gdb_server_i.breakpoint_type != rv_target_breakpoint_type_hardware)) {
+        return;
+    }
+    while (p && (strncmp(p, ";X", 2) == 0)) {
+        if (sscanf(p, ";X%x,", (unsigned int*)&len) != 1) {
+            gdb_server_cond_remove();
+            return;
+        }
+        for (i = 0; i < GDB_SERVER_CONFIG_COND_NUM; i++) {
+            if (gdb_server_i.conds[i].len == 0) {
+                break;
+            }
+        }
+        p = strchr(p, ',');
+        if ((i == GDB_SERVER_CONFIG_COND_NUM) || (p == NULL) ||
+            (len == 0) || (len > GDB_SERVER_CONFIG_COND_SIZE)) {
+            gdb_server_cond_remove();
+            return;
+        }
+        p++;
+        hex_to_bin(p, gdb_server_i.conds[i].code, len);
+        gdb_server_i.conds[i].addr = gdb_server_i.breakpoint_addr;
+        gdb_server_i.conds[i].type = gdb_server_i.breakpoint_type;
+        gdb_server_i.conds[i].kind = gdb_server_i.breakpoint_kind;
+        gdb_server_i.conds[i].len = len;
+        p = strchr(p, ';');
+    }
+}
+
+/*
+ * The hart halted at a breakpoint with conditions: if they are all false,
+ * step over it and run on without bothering GDB. Returns false if the halt
+ * is to be reported.
+ */
+static bool gdb_server_cond_skip(void)
+{
+    uint32_t i;
+    uint64_t pc = 0;
+    int64_t result;
+    gdb_server_cond_t* cond = NULL;
+
+    if ((gdb_server_i.halt_info.reason != rv_target_halt_reason_software_breakpoint) &&
+        (gdb_server_i.halt_info.reason != rv_target_halt_reason_hardware_breakpoint)) {
+        return false;
+    }
+    rv_target_read_register(&pc, RV_REG_PC);
+    for (i = 0; i < GDB_SERVER_CONFIG_COND_NUM; i++) {
+        if ((gdb_server_i.conds[i].len == 0) || (gdb_server_i.conds[i].addr != pc)) {
+            continue;
+        }
+        /* an expression that fails to evaluate stops, as in gdbserver */
+        if ((gdb_agent_eval(gdb_server_i.conds[i].code, gdb_server_i.conds[i].len, NULL, &result) != GDB_AGENT_OK) ||
+            (result != 0)) {
+            return false;
+        }
+        cond = &gdb_server_i.conds[i];
+    }
+    if (cond == NULL) {
+        return false;
+    }
+
+    return gdb_server_step_over(cond->type, cond->addr, cond->kind);
+}
+
+/*
+ * The hart halted at a tracepoint: collect a frame and run on, unless GDB
+ * has a breakpoint there too.
+ */
+static bool gdb_server_trace_hit(void)
+{
+    uint64_t pc = 0;
+    uint32_t kind;
+
+    if (gdb_server_i.halt_info.reason != rv_target_halt_reason_software_breakpoint) {
+        return false;
+    }
+    rv_target_read_register(&pc, RV_REG_PC);
+    if (!gdb_trace_hit(pc, &kind) ||
+        (rv_target_breakpoint_owners(rv_target_breakpoint_type_software, pc) & RV_TARGET_BREAKPOINT_OWNER_GDB)) {
+        return false;
+    }
+    return gdb_server_step_over(rv_target_breakpoint_type_software, pc, kind);
+}
+
+/*
+ * The hart halted at a semihosting call: serve it on the probe and run on,
+ * GDB only hears of console I/O and the exit.
+ */
+static bool gdb_server_semihost(void)
+{
+    uint64_t addr;
+    uint32_t len;
+
+    if (gdb_server_i.halt_info.reason != rv_target_halt_reason_software_breakpoint) {
+        return false;
+    }
+    switch (gdb_semihost_call(gdb_server_semihost_output)) {
+    case gdb_semihost_result_resume:
+        gdb_server_run_on();
+        return true;
+    case gdb_semihost_result_read:
+        /* GDB writes the input to memory and replies with ‘F’ */
+        gdb_semihost_read_args(&addr, &len);
+        gdb_server_target_run(false);
+        gdb_server_i.semihost_read = true;
+        rsp.len = snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "Fread,0,%x,%x", (unsigned int)addr, (unsigned int)len);
+        gdb_server_send_response();
+        return true;
+    case gdb_semihost_result_exit:
+        gdb_server_target_run(false);
+        gdb_server_i.range_step = false;
+        rsp.len = snprintf(rsp.data, GDB_PACKET_BUFF_SIZE, "W%02x", (unsigned int)(gdb_semihost_exit_code() & 0xff));
+        gdb_server_send_response();
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Console output of the target, as ‘O’ packets while GDB waits for it to stop.
+ */
+static void gdb_server_semihost_output(const uint8_t* data, uint32_t len)
+{
+    uint32_t n;
+
+    while (len) {
+        n = (len > (GDB_PACKET_BUFF_SIZE - 1) / 2) ? ((GDB_PACKET_BUFF_SIZE - 1) / 2) : len;
+        rsp.data[0] = 'O';
+        bin_to_hex(data, &rsp.data[1], n);
+        rsp.len = 1 + n * 2;
+        gdb_server_send_response();
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Step the halted hart over the breakpoint at addr and resume. Returns false
+ * if the step itself halted for another reason, which is to be reported.
+ */
+static bool gdb_server_step_over(rv_target_breakpoint_type_t type, uint64_t addr, uint32_t kind)
+{
+    bool removed, stepped;
+    uint32_t owners;
+
+    /* out for all its owners, a tracepoint that just ended the experiment is already out */
+    owners = rv_target_breakpoint_owners(type, addr);
+    rv_target_remove_breakpoint(type, addr, kind, owners, &gdb_server_i.breakpoint_err);
+    removed = (owners != 0) && (gdb_server_i.breakpoint_err == 0);
+    stepped = rv_target_step_wait();
+    /* if the step is still running it goes back in at the next resume */
+    if (removed) {
+        rv_target_insert_breakpoint(type, addr, kind, owners, &gdb_server_i.breakpoint_err);
+    }
+    if (!stepped) {
+        gdb_server_i.step_pending = true;
+        gdb_server_target_run(true);
+        return true;
+    }
+    rv_target_halt_check(&gdb_server_i.halt_info);
+    if (gdb_server_i.halt_info.reason != rv_target_halt_reason_other) {
+        return false;
+    }
+    gdb_server_run_on();
+    return true;
+}
+
+/*
+ * A step of the probe's own was left running and has ended: its halt is not
+ * for GDB, carry on with what it was stepping for. Returns false if the hart
+ * halted for another reason, which goes through the other checks.
+ */
+static bool gdb_server_step_done(void)
+{
+    if (!gdb_server_i.step_pending) {
+        return false;
+    }
+    gdb_server_i.step_pending = false;
+    if (gdb_server_i.halt_info.reason != rv_target_halt_reason_other) {
+        return false;
+    }
+    gdb_server_run_on();
+    return true;
+}
+
+/*
+ * ‘vCont;r’: step while pc stays in [range_start,range_end), checking it
+ * first if check. A halt on the way goes through gdb_server_halted() as
+ * after ‘c’; a step that does not end in time or a packet from GDB hands
+ * the hart over to the run loop, which comes back here.
+ */
+static void gdb_server_range_step(bool check)
+{
+    uint64_t pc;
+
+    gdb_server_i.range_next = false;
+    for (;;) {
+        if (check) {
+            pc = 0;
+            rv_target_read_register(&pc, RV_REG_PC);
+            if ((pc < gdb_server_i.range_start) || (pc >= gdb_server_i.range_end)) {
+                gdb_server_i.halt_info.reason = rv_target_halt_reason_other;
+                gdb_server_reply_halted();
+                return;
+            }
+            /* Ctrl+C or anything else from GDB, the run loop answers it */
+            if (uxQueueMessagesWaiting(gdb_cmd_packet_xQueue)) {
+                gdb_server_i.range_next = true;
+                gdb_server_target_run(true);
+                return;
+            }
+        }
+        check = true;
+        if (!rv_target_step_wait()) {
+            gdb_server_i.step_pending = true;
+            gdb_server_target_run(true);
+            return;
+        }
+        rv_target_halt_check(&gdb_server_i.halt_info);
+        if (gdb_server_i.halt_info.reason != rv_target_halt_reason_other) {
+            gdb_server_halted();
+            return;
+        }
+    }
+}
+
+/*
+ * Carry on after a halt the probe dealt with itself: resume, or go back to
+ * stepping through the ‘vCont;r’ range.
+ */
+static void gdb_server_run_on(void)
+{
+    if (gdb_server_i.range_step) {
+        gdb_server_i.range_next = true;
+    } else {
+        rv_target_resume();
+    }
+    gdb_server_target_run(true);
 }
 
 static void gdb_server_reply_ok(void)
@@ -749,6 +1571,126 @@ static void gdb_server_reply_err(int err)
 static void gdb_server_send_response(void)
 {
     xQueueSend(gdb_rsp_packet_xQueue, &rsp, portMAX_DELAY);
+    gdb_rsp_packet_acquire(&rsp);
+}
+
+/*
+ * Append the expedited registers ‘n:r;’ to the stop reply in rsp and send it,
+ * so GDB does not need to read them back right after the stop.
+ */
+static void gdb_server_reply_stop(void)
+{
+    uint32_t i;
+    uint32_t num = sizeof(gdb_server_expedited_regs) / sizeof(gdb_server_expedited_regs[0]);
+    uint64_t regs[sizeof(gdb_server_expedited_regs) / sizeof(gdb_server_expedited_regs[0])];
+
+    /* a stop ends what the probe was stepping through for GDB */
+    gdb_server_i.step_pending = false;
+    gdb_server_i.range_step = false;
+    gdb_server_i.range_next = false;
+    if (gdb_server_i.halt_info.reason != rv_target_halt_reason_running) {
+        rv_target_read_registers(regs, gdb_server_expedited_regs, num);
+        for (i = 0; i < num; i++) {
+            rsp.len += snprintf(&rsp.data[rsp.len], GDB_PACKET_BUFF_SIZE - rsp.len, "%02x:", (unsigned int)gdb_server_expedited_regs[i]);
+            if (MXL_RV32 == rv_target_mxl()) {
+                uint32_to_hex_le((uint32_t)regs[i], &rsp.data[rsp.len]);
+                rsp.len += MXL_RV32 * 8;
+            } else if (MXL_RV64 == rv_target_mxl()) {
+                uint64_to_hex_le(regs[i], &rsp.data[rsp.len]);
+                rsp.len += MXL_RV64 * 8;
+            }
+            rsp.data[rsp.len++] = ';';
+        }
+        rsp.data[rsp.len] = 0;
+    }
+    gdb_server_send_response();
+}
+
+/*
+ * Reply to ‘m’/‘x’ in fragments of GDB_SERVER_CONFIG_STREAM_CHUNK_SIZE bytes:
+ * each one is queued as soon as it is read and encoded, so USB transmit of
+ * one fragment overlaps the target read of the next. Without acks there is
+ * no resend, which would need the whole reply, so this is NoAck mode only.
+ */
+static void gdb_server_reply_memory(bool binary)
+{
+    uint32_t offset, chunk;
+
+    rsp.flags = GDB_PACKET_FLAG_FIRST;
+    rsp.len = 0;
+    if (binary && gdb_server_i.binary_upload) {
+        rsp.data[rsp.len++] = 'b';
+    }
+
+    offset = 0;
+    do {
+        chunk = gdb_server_i.mem_len - offset;
+        if (chunk > GDB_SERVER_CONFIG_STREAM_CHUNK_SIZE) {
+            chunk = GDB_SERVER_CONFIG_STREAM_CHUNK_SIZE;
+        }
+        rv_target_read_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr + offset, chunk);
+        if (binary) {
+            rsp.len += bin_encode(&rsp.data[rsp.len], gdb_server_i.mem_buffer, chunk, chunk * 2);
+        } else {
+            bin_to_hex(gdb_server_i.mem_buffer, &rsp.data[rsp.len], chunk);
+            rsp.len += chunk * 2;
+        }
+        offset += chunk;
+        if (offset >= gdb_server_i.mem_len) {
+            rsp.flags |= GDB_PACKET_FLAG_LAST;
+        }
+        gdb_server_send_response();
+        rsp.flags = 0;
+    } while (offset < gdb_server_i.mem_len);
+    rsp.flags = GDB_PACKET_FLAG_WHOLE;
+}
+
+/*
+ * One fragment of a streamed ‘X’/‘vFlashWrite’ payload, see gdb-packet.c.
+ * It is decoded and written out at once, only a tail that does not end on
+ * a word (or flash page) boundary is kept back for the next fragment. The
+ * checksum is known with the LAST fragment only, when the data is already
+ * written, so a bad one can not be rolled back and is answered with an error.
+ */
+static void gdb_server_stream_write(const uint8_t* xbin, uint32_t xbin_len)
+{
+    uint32_t len, align, tail;
+
+    len = gdb_server_i.stream_len;
+    len += bin_decode(xbin, &gdb_server_i.mem_buffer[len], xbin_len, &gdb_server_i.stream_escape);
+
+    if (cmd.flags & GDB_PACKET_FLAG_LAST) {
+        align = len;
+    } else {
+        tail = (uint32_t)gdb_server_i.mem_addr + len;
+        if (gdb_server_i.stream_cmd == 'v') {
+            tail %= GDB_SERVER_FLASH_PAGE_SIZE;
+        } else {
+            tail %= 4;
+        }
+        align = (tail <= len) ? (len - tail) : 0;
+    }
+
+    if (align) {
+        if (gdb_server_i.stream_cmd == 'v') {
+            gdb_server_i.flash_err |= flash_write(gdb_server_i.spi_base_addr, gdb_server_i.mem_buffer,
+                                                  gdb_server_i.mem_addr, align);
+        } else {
+            rv_target_write_memory(gdb_server_i.mem_buffer, gdb_server_i.mem_addr, align);
+        }
+        gdb_server_i.mem_addr += align;
+        memmove(gdb_server_i.mem_buffer, &gdb_server_i.mem_buffer[align], len - align);
+    }
+    gdb_server_i.stream_len = len - align;
+
+    if (cmd.flags & GDB_PACKET_FLAG_LAST) {
+        gdb_server_i.stream_cmd = 0;
+        if ((cmd.flags & GDB_PACKET_FLAG_ERROR) || gdb_server_i.flash_err) {
+            gdb_server_reply_err(1);
+        } else {
+            gdb_server_reply_ok();
+        }
+    }
 }
 
 static void bin_to_hex(const uint8_t *bin, char *hex, uint32_t nbyte)
@@ -861,7 +1803,7 @@ static void hex_to_uint64_le(const char *hex, uint64_t *data)
             ((uint64_t)bytes[7] << 56);
 }
 
-static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len)
+static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len, uint32_t xbin_size)
 {
     uint32_t xbin_len = 0;
     uint32_t i;
@@ -873,7 +1815,7 @@ static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len)
         } else {
             xbin[xbin_len++] = bin[i];
         }
-        if (xbin_len >= bin_len) {
+        if (xbin_len >= xbin_size) {
             break;
         }
     }
@@ -881,25 +1823,27 @@ static uint32_t bin_encode(uint8_t* xbin, uint8_t* bin, uint32_t bin_len)
     return xbin_len;
 }
 
-static uint32_t bin_decode(const uint8_t* xbin, uint8_t* bin, uint32_t xbin_len)
+static uint32_t bin_decode(const uint8_t* xbin, uint8_t* bin, uint32_t xbin_len, bool* escape)
 {
     uint32_t bin_len = 0;
     uint32_t i;
-    int escape_found = 0;
+    bool escape_found = *escape;
 
     for(i = 0; i < xbin_len; i++) {
         if (xbin[i] == 0x7d) {
-            escape_found = 1;
+            escape_found = true;
         } else {
             if (escape_found) {
                 bin[bin_len] = xbin[i] ^ 0x20;
-                escape_found = 0;
+                escape_found = false;
             } else {
                 bin[bin_len] = xbin[i];
             }
             bin_len++;
         }
     }
+    /* a fragment can end between the escape and the byte it escapes */
+    *escape = escape_found;
 
     return bin_len;
 }
@@ -0,0 +1,884 @@
+/*
+ * Copyright (c) 2019 zoomdy@163.com
+ * Copyright (c) 2020, Micha Hoiting <micha.hoiting@gmail.com>
+ * Copyright (c) 2022 Nuclei Limited. All rights reserved.
+ *
+ * Dlink is licensed under the Mulan PSL v1.
+ * You can use this software according to the terms and conditions of the Mulan PSL v1.
+ * You may obtain a copy of Mulan PSL v1 at:
+ *     http://license.coscl.org.cn/MulanPSL
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR
+ * PURPOSE.
+ * See the Mulan PSL v1 for more details.
+ */
+
+#include "gdb-trace.h"
+#include "gdb-agent.h"
+#include "riscv-target.h"
+#include "encoding.h"
+
+/*
+ * Frames are kept back to back in trace_buffer, oldest first, each a
+ * GDB_TRACE_FRAME_HEADER of tracepoint number and data size (16 bits each)
+ * followed by blocks:
+ *   '''R''' core registers, RV_TARGET_CONFIG_REG_NUM of XLEN each
+ *   '''M''' 64 bit address, 16 bit length, memory
+ *   '''V''' 16 bit number, 64 bit value of a trace state variable
+ * A frame that does not fit before the end of the buffer goes to its start,
+ * data is then [start, wrap) and [0, end).
+ */
+#define GDB_TRACE_FRAME_HEADER      (4)
+
+/* action records of a tracepoint, after the bytecode of its condition */
+#define GDB_TRACE_ACTION_REGS       'R'     /* nothing more */
+#define GDB_TRACE_ACTION_MEMORY     'M'     /* 16 bit base register, 16 bit length, 64 bit offset */
+#define GDB_TRACE_ACTION_EXPR       'X'     /* 16 bit length, bytecode */
+#define GDB_TRACE_BASEREG_NONE      (0xffff)
+
+typedef enum {
+    gdb_trace_status_not_run,
+    gdb_trace_status_running,
+    gdb_trace_status_stop,
+    gdb_trace_status_full,
+    gdb_trace_status_passcount,
+} gdb_trace_status_t;
+
+typedef struct gdb_trace_tracepoint_s
+{
+    uint32_t num;           /* 0 is a free entry */
+    uint64_t addr;
+    bool enabled;
+    bool installed;
+    uint32_t kind;
+    uint32_t pass;
+    uint32_t hits;
+    uint32_t bytes;
+    uint32_t cond_len;
+    uint32_t actions_len;
+    uint8_t actions[GDB_TRACE_CONFIG_ACTION_SIZE];
+} gdb_trace_tracepoint_t;
+
+typedef struct gdb_trace_tsv_s
+{
+    uint32_t num;           /* 0 is a free entry */
+    int64_t initial;
+    int64_t value;
+} gdb_trace_tsv_t;
+
+typedef struct gdb_trace_s
+{
+    gdb_trace_status_t status;
+    uint32_t stop_tpnum;
+    bool circular;
+
+    uint32_t start;
+    uint32_t end;
+    uint32_t wrap;
+    bool wrapped;
+    uint32_t frames;
+    uint32_t created;
+
+    /* frame being collected */
+    uint32_t frame_pos;
+    uint32_t frame_len;
+
+    /* frame selected with '''QTFrame''', -1 for none */
+    int32_t frame_num;
+    uint32_t frame_off;
+
+    gdb_trace_tracepoint_t tracepoints[GDB_TRACE_CONFIG_TRACEPOINT_NUM];
+    gdb_trace_tsv_t tsvs[GDB_TRACE_CONFIG_TSV_NUM];
+    uint64_t regs[RV_TARGET_CONFIG_REG_NUM];
+} gdb_trace_t;
+
+static gdb_trace_t gdb_trace_i;
+static uint8_t trace_buffer[GDB_TRACE_CONFIG_BUFFER_SIZE];
+
+static uint64_t gdb_trace_hex(const char** p)
+{
+    uint64_t value = 0;
+    char c;
+
+    for (;;) {
+        c = **p;
+        if ((c >= '0') && (c <= '9')) {
+            value = (value << 4) | (c - '0');
+        } else if ((c >= 'a') && (c <= 'f')) {
+            value = (value << 4) | (c - 'a' + 10);
+        } else if ((c >= 'A') && (c <= 'F')) {
+            value = (value << 4) | (c - 'A' + 10);
+        } else {
+            return value;
+        }
+        (*p)++;
+    }
+}
+
+static uint32_t gdb_trace_hex_put(char* hex, uint64_t value)
+{
+    const char digits[] = "0123456789abcdef";
+    uint32_t len = 1;
+    uint32_t i;
+
+    while ((len < 16) && (value >> (len * 4))) {
+        len++;
+    }
+    for (i = 0; i < len; i++) {
+        hex[i] = digits[(value >> ((len - 1 - i) * 4)) & 0xf];
+    }
+    hex[len] = '\0';
+    return len;
+}
+
+static void gdb_trace_hex_to_bin(const char* hex, uint8_t* bin, uint32_t len)
+{
+    char byte[3] = {0};
+    uint32_t i;
+    const char* p;
+
+    for (i = 0; i < len; i++) {
+        byte[0] = hex[i * 2];
+        byte[1] = hex[i * 2 + 1];
+        p = byte;
+        bin[i] = gdb_trace_hex(&p);
+    }
+}
+
+static gdb_trace_tracepoint_t* gdb_trace_tracepoint_find(uint32_t num, uint64_t addr)
+{
+    uint32_t i;
+
+    for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+        if ((gdb_trace_i.tracepoints[i].num == num) && (gdb_trace_i.tracepoints[i].addr == addr)) {
+            return &gdb_trace_i.tracepoints[i];
+        }
+    }
+    return NULL;
+}
+
+static gdb_trace_tsv_t* gdb_trace_tsv_find(uint32_t num)
+{
+    uint32_t i;
+
+    for (i = 0; i < GDB_TRACE_CONFIG_TSV_NUM; i++) {
+        if (gdb_trace_i.tsvs[i].num == num) {
+            return &gdb_trace_i.tsvs[i];
+        }
+    }
+    return NULL;
+}
+
+static uint32_t gdb_trace_frame_size(uint32_t off)
+{
+    uint16_t size;
+
+    memcpy(&size, &trace_buffer[off + 2], 2);
+    return size;
+}
+
+static uint32_t gdb_trace_frame_next(uint32_t off)
+{
+    off += GDB_TRACE_FRAME_HEADER + gdb_trace_frame_size(off);
+    if (gdb_trace_i.wrapped && (off == gdb_trace_i.wrap)) {
+        off = 0;
+    }
+    return off;
+}
+
+static void gdb_trace_frame_drop(void)
+{
+    gdb_trace_i.start = gdb_trace_frame_next(gdb_trace_i.start);
+    if (gdb_trace_i.start == 0) {
+        gdb_trace_i.wrapped = false;
+    }
+    gdb_trace_i.frames--;
+}
+
+/*
+ * Room for a frame of up to len bytes, dropping the oldest frames in
+ * circular mode. Returns false if the buffer is full.
+ */
+static bool gdb_trace_frame_reserve(uint32_t len)
+{
+    for (;;) {
+        if (gdb_trace_i.frames == 0) {
+            gdb_trace_i.start = 0;
+            gdb_trace_i.end = 0;
+            gdb_trace_i.wrapped = false;
+        }
+        if (!gdb_trace_i.wrapped) {
+            if (GDB_TRACE_CONFIG_BUFFER_SIZE - gdb_trace_i.end >= len) {
+                break;
+            }
+            if (gdb_trace_i.start >= len) {
+                gdb_trace_i.wrap = gdb_trace_i.end;
+                gdb_trace_i.wrapped = true;
+                gdb_trace_i.end = 0;
+                break;
+            }
+        } else if (gdb_trace_i.start - gdb_trace_i.end >= len) {
+            break;
+        }
+        if (!gdb_trace_i.circular) {
+            return false;
+        }
+        gdb_trace_frame_drop();
+    }
+    gdb_trace_i.frame_pos = gdb_trace_i.end + GDB_TRACE_FRAME_HEADER;
+    gdb_trace_i.frame_len = 0;
+    return true;
+}
+
+static uint8_t* gdb_trace_frame_block(uint32_t len)
+{
+    uint8_t* block;
+
+    if (gdb_trace_i.frame_len + len > GDB_TRACE_CONFIG_FRAME_SIZE - GDB_TRACE_FRAME_HEADER) {
+        return NULL;
+    }
+    block = &trace_buffer[gdb_trace_i.frame_pos + gdb_trace_i.frame_len];
+    gdb_trace_i.frame_len += len;
+    return block;
+}
+
+static void gdb_trace_collect_memory(uint64_t addr, uint32_t size)
+{
+    uint8_t* block;
+    uint32_t room;
+    uint16_t len;
+
+    room = GDB_TRACE_CONFIG_FRAME_SIZE - GDB_TRACE_FRAME_HEADER - gdb_trace_i.frame_len;
+    if (room <= 11) {
+        return;
+    }
+    /* what does not fit is cut off */
+    len = (size > room - 11) ? (room - 11) : size;
+    block = gdb_trace_frame_block(11 + len);
+    block[0] = 'M';
+    memcpy(&block[1], &addr, 8);
+    memcpy(&block[9], &len, 2);
+    rv_target_read_memory(&block[11], addr, len);
+}
+
+static void gdb_trace_collect_registers(void)
+{
+    uint32_t len = rv_target_mxl() * 4 * RV_TARGET_CONFIG_REG_NUM;
+    uint8_t* block;
+
+    block = gdb_trace_frame_block(1 + len);
+    if (block) {
+        rv_target_read_core_registers(gdb_trace_i.regs);
+        block[0] = 'R';
+        memcpy(&block[1], gdb_trace_i.regs, len);
+    }
+}
+
+void gdb_trace_tsv_collect(uint32_t num)
+{
+    gdb_trace_tsv_t* tsv;
+    uint8_t* block;
+    uint16_t n = num;
+
+    tsv = gdb_trace_tsv_find(num);
+    if (tsv && (block = gdb_trace_frame_block(11))) {
+        block[0] = 'V';
+        memcpy(&block[1], &n, 2);
+        memcpy(&block[3], &tsv->value, 8);
+    }
+}
+
+bool gdb_trace_tsv_get(uint32_t num, int64_t* value)
+{
+    gdb_trace_tsv_t* tsv;
+
+    tsv = gdb_trace_tsv_find(num);
+    if ((num == 0) || (tsv == NULL)) {
+        return false;
+    }
+    *value = tsv->value;
+    return true;
+}
+
+bool gdb_trace_tsv_set(uint32_t num, int64_t value)
+{
+    gdb_trace_tsv_t* tsv;
+
+    tsv = gdb_trace_tsv_find(num);
+    if ((num == 0) || (tsv == NULL)) {
+        return false;
+    }
+    tsv->value = value;
+    return true;
+}
+
+static void gdb_trace_install(bool install)
+{
+    gdb_trace_tracepoint_t* tp;
+    uint32_t i, err;
+    uint16_t inst = 0;
+
+    for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+        tp = &gdb_trace_i.tracepoints[i];
+        if (install && tp->num && tp->enabled && !tp->installed) {
+            /* compressed instructions do not have both low bits set */
+            rv_target_read_memory((uint8_t*)&inst, tp->addr, 2);
+            tp->kind = ((inst & 3) == 3) ? 4 : 2;
+            rv_target_insert_breakpoint(rv_target_breakpoint_type_software, tp->addr, tp->kind,
+                                        RV_TARGET_BREAKPOINT_OWNER_TRACE, &err);
+            tp->installed = (err == 0);
+        } else if (!install && tp->installed) {
+            rv_target_remove_breakpoint(rv_target_breakpoint_type_software, tp->addr, tp->kind,
+                                        RV_TARGET_BREAKPOINT_OWNER_TRACE, &err);
+            tp->installed = false;
+        }
+    }
+}
+
+static void gdb_trace_stop(gdb_trace_status_t status, uint32_t tpnum)
+{
+    gdb_trace_install(false);
+    gdb_trace_i.status = status;
+    gdb_trace_i.stop_tpnum = tpnum;
+}
+
+void gdb_trace_init(void)
+{
+    if (gdb_trace_i.status == gdb_trace_status_running) {
+        gdb_trace_install(false);
+    }
+    memset(&gdb_trace_i, 0, sizeof(gdb_trace_i));
+    gdb_trace_i.status = gdb_trace_status_not_run;
+    gdb_trace_i.frame_num = -1;
+}
+
+bool gdb_trace_running(void)
+{
+    return gdb_trace_i.status == gdb_trace_status_running;
+}
+
+bool gdb_trace_hit(uint64_t pc, uint32_t* kind)
+{
+    gdb_trace_tracepoint_t* tp = NULL;
+    uint32_t i;
+    uint8_t* p;
+    uint8_t* end;
+    uint16_t basereg, len;
+    uint64_t addr;
+    uint64_t base;
+    int64_t result;
+
+    if (gdb_trace_i.status != gdb_trace_status_running) {
+        return false;
+    }
+    for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+        if (gdb_trace_i.tracepoints[i].installed && (gdb_trace_i.tracepoints[i].addr == pc)) {
+            tp = &gdb_trace_i.tracepoints[i];
+            break;
+        }
+    }
+    if (tp == NULL) {
+        return false;
+    }
+    *kind = tp->kind;
+
+    if (tp->cond_len) {
+        if ((gdb_agent_eval(tp->actions, tp->cond_len, NULL, &result) != GDB_AGENT_OK) || (result == 0)) {
+            return true;
+        }
+    }
+
+    if (!gdb_trace_frame_reserve(GDB_TRACE_CONFIG_FRAME_SIZE)) {
+        gdb_trace_stop(gdb_trace_status_full, 0);
+        return true;
+    }
+    p = &tp->actions[tp->cond_len];
+    end = &tp->actions[tp->actions_len];
+    while (p < end) {
+        if (*p == GDB_TRACE_ACTION_REGS) {
+            gdb_trace_collect_registers();
+            p += 1;
+        } else if (*p == GDB_TRACE_ACTION_MEMORY) {
+            memcpy(&basereg, &p[1], 2);
+            memcpy(&len, &p[3], 2);
+            memcpy(&addr, &p[5], 8);
+            if (basereg != GDB_TRACE_BASEREG_NONE) {
+                base = 0;
+                rv_target_read_register(&base, basereg);
+                addr += base;
+            }
+            gdb_trace_collect_memory(addr, len);
+            p += 13;
+        } else {
+            memcpy(&len, &p[1], 2);
+            gdb_agent_eval(&p[3], len, gdb_trace_collect_memory, &result);
+            p += 3 + len;
+        }
+    }
+
+    /* commit the frame */
+    len = tp->num;
+    memcpy(&trace_buffer[gdb_trace_i.end], &len, 2);
+    len = gdb_trace_i.frame_len;
+    memcpy(&trace_buffer[gdb_trace_i.end + 2], &len, 2);
+    gdb_trace_i.end += GDB_TRACE_FRAME_HEADER + gdb_trace_i.frame_len;
+    gdb_trace_i.frames++;
+    gdb_trace_i.created++;
+    tp->hits++;
+    tp->bytes += GDB_TRACE_FRAME_HEADER + gdb_trace_i.frame_len;
+
+    if (tp->pass && (tp->hits >= tp->pass)) {
+        gdb_trace_stop(gdb_trace_status_passcount, tp->num);
+    }
+    return true;
+}
+
+bool gdb_trace_frame_selected(void)
+{
+    return gdb_trace_i.frame_num >= 0;
+}
+
+static uint8_t* gdb_trace_block_next(uint8_t* block)
+{
+    uint16_t len;
+
+    if (*block == 'R') {
+        return block + 1 + rv_target_mxl() * 4 * RV_TARGET_CONFIG_REG_NUM;
+    } else if (*block == 'M') {
+        memcpy(&len, &block[9], 2);
+        return block + 11 + len;
+    }
+    return block + 11;
+}
+
+/*
+ * The block of type after block in the selected frame, the first one if
+ * block is NULL. Returns NULL if there is none.
+ */
+static uint8_t* gdb_trace_frame_find(uint8_t* block, char type)
+{
+    uint8_t* p = &trace_buffer[gdb_trace_i.frame_off + GDB_TRACE_FRAME_HEADER];
+    uint8_t* end = p + gdb_trace_frame_size(gdb_trace_i.frame_off);
+
+    if (block) {
+        p = gdb_trace_block_next(block);
+    }
+    while (p < end) {
+        if (*p == type) {
+            return p;
+        }
+        p = gdb_trace_block_next(p);
+    }
+    return NULL;
+}
+
+bool gdb_trace_frame_registers(uint64_t* regs)
+{
+    uint8_t* block;
+    uint16_t tpnum;
+    uint32_t i;
+
+    block = gdb_trace_frame_find(NULL, 'R');
+    if (block) {
+        memcpy(regs, &block[1], rv_target_mxl() * 4 * RV_TARGET_CONFIG_REG_NUM);
+        return true;
+    }
+
+    /* without registers the pc is still known, it is the tracepoint address */
+    memset(regs, 0, sizeof(uint64_t) * RV_TARGET_CONFIG_REG_NUM);
+    memcpy(&tpnum, &trace_buffer[gdb_trace_i.frame_off], 2);
+    for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+        if (gdb_trace_i.tracepoints[i].num == tpnum) {
+            if (MXL_RV32 == rv_target_mxl()) {
+                ((uint32_t*)regs)[RV_REG_PC] = gdb_trace_i.tracepoints[i].addr;
+            } else {
+                regs[RV_REG_PC] = gdb_trace_i.tracepoints[i].addr;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+uint32_t gdb_trace_frame_memory(uint8_t* mem, uint64_t addr, uint32_t len)
+{
+    uint8_t* block = NULL;
+    uint64_t block_addr;
+    uint16_t block_len;
+
+    while ((block = gdb_trace_frame_find(block, 'M')) != NULL) {
+        memcpy(&block_addr, &block[1], 8);
+        memcpy(&block_len, &block[9], 2);
+        if ((addr >= block_addr) && (addr < block_addr + block_len)) {
+            if (len > block_addr + block_len - addr) {
+                len = block_addr + block_len - addr;
+            }
+            memcpy(mem, &block[11 + (addr - block_addr)], len);
+            return len;
+        }
+    }
+    return 0;
+}
+
+/*
+ * '''QTDP:n:addr:ena:step:pass[:Xlen,cond][-]''' defines a tracepoint,
+ * '''QTDP:-n:addr:[S]actions[-]''' adds actions to it. While-stepping ('''S''')
+ * actions are not supported and ignored.
+ */
+static bool gdb_trace_cmd_qtdp(const char* p)
+{
+    gdb_trace_tracepoint_t* tp;
+    uint32_t num, len;
+    uint64_t addr;
+    uint16_t basereg, len16;
+    uint8_t* rec;
+    char type;
+    bool neg;
+
+    if (*p == '-') {
+        p++;
+        num = gdb_trace_hex(&p);
+        p++;
+        addr = gdb_trace_hex(&p);
+        p++;
+        tp = gdb_trace_tracepoint_find(num, addr);
+        if (tp == NULL) {
+            return false;
+        }
+        while (*p && (*p != '-') && (*p != 'S')) {
+            rec = &tp->actions[tp->actions_len];
+            type = *p++;
+            if (type == GDB_TRACE_ACTION_REGS) {
+                /* the mask is not looked at, all core registers are collected */
+                gdb_trace_hex(&p);
+                if (1 + rv_target_mxl() * 4 * RV_TARGET_CONFIG_REG_NUM >
+                    GDB_TRACE_CONFIG_FRAME_SIZE - GDB_TRACE_FRAME_HEADER) {
+                    return false;
+                }
+                len = 1;
+            } else if (type == GDB_TRACE_ACTION_MEMORY) {
+                /* base register -1 for an absolute address */
+                neg = (*p == '-');
+                if (neg) {
+                    p++;
+                }
+                basereg = gdb_trace_hex(&p);
+                if (neg) {
+                    basereg = GDB_TRACE_BASEREG_NONE;
+                }
+                p++;
+                addr = gdb_trace_hex(&p);
+                p++;
+                len16 = gdb_trace_hex(&p);
+                len = 13;
+            } else if (type == GDB_TRACE_ACTION_EXPR) {
+                len16 = gdb_trace_hex(&p);
+                p++;
+                len = 3 + len16;
+            } else {
+                return false;
+            }
+            if (tp->actions_len + len > GDB_TRACE_CONFIG_ACTION_SIZE) {
+                return false;
+            }
+            rec[0] = type;
+            if (type == GDB_TRACE_ACTION_MEMORY) {
+                memcpy(&rec[1], &basereg, 2);
+                memcpy(&rec[3], &len16, 2);
+                memcpy(&rec[5], &addr, 8);
+            } else if (type == GDB_TRACE_ACTION_EXPR) {
+                memcpy(&rec[1], &len16, 2);
+                gdb_trace_hex_to_bin(p, &rec[3], len16);
+                p += len16 * 2;
+            }
+            tp->actions_len += len;
+        }
+        return true;
+    }
+
+    num = gdb_trace_hex(&p);
+    p++;
+    addr = gdb_trace_hex(&p);
+    p++;
+    tp = gdb_trace_tracepoint_find(num, addr);
+    if (tp == NULL) {
+        tp = gdb_trace_tracepoint_find(0, 0);
+    }
+    if ((tp == NULL) || (num == 0)) {
+        return false;
+    }
+    memset(tp, 0, sizeof(*tp));
+    tp->num = num;
+    tp->addr = addr;
+    tp->enabled = (*p == 'E');
+    p += 2;
+    gdb_trace_hex(&p);
+    p++;
+    tp->pass = gdb_trace_hex(&p);
+    while (*p == ':') {
+        p++;
+        if (*p == 'X') {
+            p++;
+            len = gdb_trace_hex(&p);
+            p++;
+            if (len > GDB_TRACE_CONFIG_ACTION_SIZE) {
+                tp->num = 0;
+                return false;
+            }
+            gdb_trace_hex_to_bin(p, tp->actions, len);
+            p += len * 2;
+            tp->cond_len = len;
+            tp->actions_len = len;
+        } else {
+            /* fast ('''F''') and static ('''S''') tracepoints are not supported */
+            tp->num = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * '''QTDV:n:value:builtin:name'''
+ */
+static bool gdb_trace_cmd_qtdv(const char* p)
+{
+    gdb_trace_tsv_t* tsv;
+    uint32_t num;
+
+    num = gdb_trace_hex(&p);
+    tsv = gdb_trace_tsv_find(num);
+    if (tsv == NULL) {
+        tsv = gdb_trace_tsv_find(0);
+    }
+    if ((tsv == NULL) || (num == 0)) {
+        return false;
+    }
+    p++;
+    tsv->num = num;
+    tsv->initial = gdb_trace_hex(&p);
+    tsv->value = tsv->initial;
+    return true;
+}
+
+/*
+ * '''QTFrame:n''', '''QTFrame:pc:addr''', '''QTFrame:tdp:t''',
+ * '''QTFrame:range:start:end''', '''QTFrame:outside:start:end'''
+ * Select a trace frame, searching forward from the selected one.
+ */
+static uint32_t gdb_trace_cmd_qtframe(const char* p, char* reply, uint32_t size)
+{
+    int32_t n, from;
+    uint32_t off;
+    uint64_t arg1 = 0, arg2 = 0, addr;
+    uint16_t tpnum;
+    uint32_t i;
+    char type;
+    bool found;
+
+    if (strncmp(p, "pc:", 3) == 0) {
+        type = 'p';
+        p += 3;
+    } else if (strncmp(p, "tdp:", 4) == 0) {
+        type = 't';
+        p += 4;
+    } else if (strncmp(p, "range:", 6) == 0) {
+        type = 'r';
+        p += 6;
+    } else if (strncmp(p, "outside:", 8) == 0) {
+        type = 'o';
+        p += 8;
+    } else {
+        type = 'n';
+    }
+    if (*p == '-') {
+        /* '''QTFrame:-1''', back to the live target */
+        gdb_trace_i.frame_num = -1;
+        return snprintf(reply, size, "OK");
+    }
+    arg1 = gdb_trace_hex(&p);
+    if (*p == ':') {
+        p++;
+        arg2 = gdb_trace_hex(&p);
+    }
+
+    from = (type == 'n') ? 0 : gdb_trace_i.frame_num + 1;
+    off = gdb_trace_i.start;
+    for (n = 0; n < (int32_t)gdb_trace_i.frames; n++, off = gdb_trace_frame_next(off)) {
+        if (n < from) {
+            continue;
+        }
+        memcpy(&tpnum, &trace_buffer[off], 2);
+        addr = 0;
+        for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+            if (gdb_trace_i.tracepoints[i].num == tpnum) {
+                addr = gdb_trace_i.tracepoints[i].addr;
+                break;
+            }
+        }
+        if (type == 'n') {
+            found = ((uint64_t)n == arg1);
+        } else if (type == 'p') {
+            found = (addr == arg1);
+        } else if (type == 't') {
+            found = (tpnum == arg1);
+        } else if (type == 'r') {
+            found = (addr >= arg1) && (addr <= arg2);
+        } else {
+            found = (addr < arg1) || (addr > arg2);
+        }
+        if (found) {
+            gdb_trace_i.frame_num = n;
+            gdb_trace_i.frame_off = off;
+            return snprintf(reply, size, "F%xT%x", (unsigned int)n, (unsigned int)tpnum);
+        }
+    }
+    gdb_trace_i.frame_num = -1;
+    return snprintf(reply, size, "F-1");
+}
+
+static uint32_t gdb_trace_cmd_qtstatus(char* reply, uint32_t size)
+{
+    const char* reason;
+    uint32_t used, len;
+
+    switch (gdb_trace_i.status) {
+    case gdb_trace_status_stop:         reason = "tstop"; break;
+    case gdb_trace_status_full:         reason = "tfull"; break;
+    case gdb_trace_status_passcount:    reason = "tpasscount"; break;
+    default:                            reason = "tnotrun"; break;
+    }
+    if (gdb_trace_i.frames == 0) {
+        used = 0;
+    } else if (gdb_trace_i.wrapped) {
+        used = gdb_trace_i.wrap - gdb_trace_i.start + gdb_trace_i.end;
+    } else {
+        used = gdb_trace_i.end - gdb_trace_i.start;
+    }
+    len = snprintf(reply, size, "T%d;%s:%x;tframes:%x;tcreated:%x;tfree:%x;tsize:%x;circular:%d;disconn:0",
+                   (gdb_trace_i.status == gdb_trace_status_running) ? 1 : 0,
+                   reason, (unsigned int)gdb_trace_i.stop_tpnum,
+                   (unsigned int)gdb_trace_i.frames, (unsigned int)gdb_trace_i.created,
+                   (unsigned int)(GDB_TRACE_CONFIG_BUFFER_SIZE - used), GDB_TRACE_CONFIG_BUFFER_SIZE,
+                   gdb_trace_i.circular ? 1 : 0);
+    return len;
+}
+
+/*
+ * '''qTV:n''', the value of a trace state variable, from the selected frame if
+ * it collected one.
+ */
+static uint32_t gdb_trace_cmd_qtv(const char* p, char* reply)
+{
+    uint8_t* block = NULL;
+    uint16_t n;
+    uint32_t num;
+    int64_t value;
+
+    num = gdb_trace_hex(&p);
+    if (gdb_trace_frame_selected()) {
+        while ((block = gdb_trace_frame_find(block, 'V')) != NULL) {
+            memcpy(&n, &block[1], 2);
+            if (n == num) {
+                memcpy(&value, &block[3], 8);
+                reply[0] = 'V';
+                return 1 + gdb_trace_hex_put(&reply[1], value);
+            }
+        }
+    } else if (gdb_trace_tsv_get(num, &value)) {
+        reply[0] = 'V';
+        return 1 + gdb_trace_hex_put(&reply[1], value);
+    }
+    reply[0] = 'U';
+    return 1;
+}
+
+uint32_t gdb_trace_command(const char* packet, char* reply, uint32_t size)
+{
+    gdb_trace_tracepoint_t* tp;
+    const char* p;
+    uint32_t num, i;
+    uint64_t addr;
+    bool ok = true;
+
+    if (strncmp(packet, "QTinit", 6) == 0) {
+        gdb_trace_init();
+    } else if (strncmp(packet, "QTDPsrc:", 8) == 0) {
+        /* the source text is only for GDB to upload again, not kept */
+    } else if (strncmp(packet, "QTDP:", 5) == 0) {
+        ok = gdb_trace_cmd_qtdp(&packet[5]);
+    } else if (strncmp(packet, "QTDV:", 5) == 0) {
+        ok = gdb_trace_cmd_qtdv(&packet[5]);
+    } else if ((strncmp(packet, "QTEnable:", 9) == 0) || (strncmp(packet, "QTDisable:", 10) == 0)) {
+        p = strchr(packet, ':') + 1;
+        num = gdb_trace_hex(&p);
+        p++;
+        addr = gdb_trace_hex(&p);
+        tp = gdb_trace_tracepoint_find(num, addr);
+        ok = (tp != NULL);
+        if (ok) {
+            tp->enabled = (packet[2] == 'E');
+            if (gdb_trace_i.status == gdb_trace_status_running) {
+                if (tp->enabled) {
+                    gdb_trace_install(true);
+                } else if (tp->installed) {
+                    rv_target_remove_breakpoint(rv_target_breakpoint_type_software, tp->addr, tp->kind,
+                                                RV_TARGET_BREAKPOINT_OWNER_TRACE, &i);
+                    tp->installed = false;
+                }
+            }
+        }
+    } else if (strncmp(packet, "QTStart", 7) == 0) {
+        gdb_trace_i.start = 0;
+        gdb_trace_i.end = 0;
+        gdb_trace_i.wrapped = false;
+        gdb_trace_i.frames = 0;
+        gdb_trace_i.created = 0;
+        gdb_trace_i.frame_num = -1;
+        for (i = 0; i < GDB_TRACE_CONFIG_TSV_NUM; i++) {
+            gdb_trace_i.tsvs[i].value = gdb_trace_i.tsvs[i].initial;
+        }
+        for (i = 0; i < GDB_TRACE_CONFIG_TRACEPOINT_NUM; i++) {
+            gdb_trace_i.tracepoints[i].hits = 0;
+            gdb_trace_i.tracepoints[i].bytes = 0;
+        }
+        gdb_trace_install(true);
+        gdb_trace_i.status = gdb_trace_status_running;
+        gdb_trace_i.stop_tpnum = 0;
+    } else if (strncmp(packet, "QTStop", 6) == 0) {
+        if (gdb_trace_i.status == gdb_trace_status_running) {
+            gdb_trace_stop(gdb_trace_status_stop, 0);
+        }
+    } else if (strncmp(packet, "QTBuffer:circular:", 18) == 0) {
+        p = &packet[18];
+        gdb_trace_i.circular = (gdb_trace_hex(&p) != 0);
+    } else if ((strncmp(packet, "QTro", 4) == 0) ||
+               (strncmp(packet, "QTNotes:", 8) == 0) ||
+               (strncmp(packet, "QTDisconnected:", 15) == 0)) {
+        /* accepted, nothing to do on the probe */
+    } else if (strncmp(packet, "QTFrame:", 8) == 0) {
+        return gdb_trace_cmd_qtframe(&packet[8], reply, size);
+    } else if (strncmp(packet, "qTStatus", 8) == 0) {
+        return gdb_trace_cmd_qtstatus(reply, size);
+    } else if (strncmp(packet, "qTV:", 4) == 0) {
+        return gdb_trace_cmd_qtv(&packet[4], reply);
+    } else if (strncmp(packet, "qTP:", 4) == 0) {
+        p = &packet[4];
+        num = gdb_trace_hex(&p);
+        p++;
+        addr = gdb_trace_hex(&p);
+        tp = gdb_trace_tracepoint_find(num, addr);
+        if (tp == NULL) {
+            return snprintf(reply, size, "E01");
+        }
+        return snprintf(reply, size, "V%x:%x", (unsigned int)tp->hits, (unsigned int)tp->bytes);
+    } else if ((strncmp(packet, "qTfP", 4) == 0) || (strncmp(packet, "qTsP", 4) == 0) ||
+               (strncmp(packet, "qTfV", 4) == 0) || (strncmp(packet, "qTsV", 4) == 0)) {
+        /* nothing to upload, GDB keeps its own definitions */
+        return snprintf(reply, size, "l");
+    } else {
+        return 0;
+    }
+    return snprintf(reply, size, ok ? "OK" : "E01");
+}
@@ -491,6 +491,7 @@ uint8_t cdc_acm_data_out_handler (usb_dev *pudev, uint8_t ep_id)
     {
         cdc0_packet_receive = 1;
         cdc0_receive_length = usbd_rxcount_get(pudev, CDC0_ACM_DATA_OUT_EP);
+        gdb_packet_received_from_isr();
         return USBD_OK;
     }
     else if ((CDC1_ACM_DATA_OUT_EP & 0x7F) == ep_id)
@@ -511,6 +512,7 @@ uint8_t cdc_acm_data_in_handler (usb_dev *pudev, uint8_t ep_id)
             usbd_ep_send (pudev, ep_id, NULL, 0U);
         } else {
             cdc0_packet_sent = 1;
+            gdb_packet_sent_from_isr();
         }
         return USBD_OK;
     }
@@ -521,6 +523,7 @@ uint8_t cdc_acm_data_in_handler (usb_dev *pudev, uint8_t ep_id)
             usbd_ep_send (pudev, ep_id, NULL, 0U);
         } else {
             cdc1_packet_sent = 1;
+            usb_serial_sent_from_isr();
         }
         return USBD_OK;
     }
@@ -23,22 +23,73 @@ extern __IO uint32_t cdc1_packet_sent;
 
 extern usb_core_driver USB_OTG_dev;
 
+/*
+ * The UART bridge and the probe share the IN endpoint of CDC1, either of them
+ * only starts a transfer once the previous one has completed. The UART fills
+ * one cache while the other one goes out, a full cache or a whole line waits
+ * for the endpoint and whatever the UART receives meanwhile is lost.
+ */
+static uint8_t cache[2][CDC_ACM_DATA_PACKET_SIZE];
+static uint8_t cache_index = 0;     /* the one being filled */
+static uint32_t cache_len = 0;
+static bool cache_full = false;
+
+static void usb_serial_send_cache(void)
+{
+    if (cache_full && cdc1_packet_sent) {
+        cdc1_packet_sent = 0;
+        usbd_ep_send(&USB_OTG_dev, CDC1_ACM_DATA_IN_EP, cache[cache_index], cache_len);
+        cache_index ^= 1;
+        cache_len = 0;
+        cache_full = false;
+    }
+}
+
 void USART0_IRQHandler(void)
 {
-    static uint8_t index = 0;
-    static uint8_t cache[CDC_ACM_DATA_PACKET_SIZE];
+    uint8_t c;
+
     if (usart_interrupt_flag_get(UART_ITF, USART_INT_FLAG_RBNE) != RESET) {
         /* read one byte from the receive data register */
-        cache[index] = (uint8_t)usart_data_receive(UART_ITF);
-        index++;
-        if ((index >= CDC_ACM_DATA_PACKET_SIZE) || ('\n' == cache[index - 1])) {
-            cdc1_packet_sent = 0;
-            usbd_ep_send(&USB_OTG_dev, CDC1_ACM_DATA_IN_EP, cache, index);
-            index = 0;
+        c = (uint8_t)usart_data_receive(UART_ITF);
+        if (!cache_full) {
+            cache[cache_index][cache_len++] = c;
+            cache_full = (cache_len >= CDC_ACM_DATA_PACKET_SIZE) || ('\n' == c);
         }
+        usb_serial_send_cache();
     }
 }
 
+void usb_serial_sent_from_isr(void)
+{
+    usart_interrupt_disable(UART_ITF, USART_INT_RBNE);
+    usb_serial_send_cache();
+    usart_interrupt_enable(UART_ITF, USART_INT_RBNE);
+}
+
+/*
+ * Data written has to stay untouched until usb_serial_ready() says so again.
+ */
+bool usb_serial_ready(void)
+{
+    return cdc1_packet_sent != 0;
+}
+
+bool usb_serial_write(const uint8_t* data, uint32_t len)
+{
+    bool ok = false;
+
+    /* keep the UART interrupt from starting a transfer in between */
+    usart_interrupt_disable(UART_ITF, USART_INT_RBNE);
+    if (cdc1_packet_sent) {
+        cdc1_packet_sent = 0;
+        usbd_ep_send(&USB_OTG_dev, CDC1_ACM_DATA_IN_EP, (uint8_t*)data, len);
+        ok = true;
+    }
+    usart_interrupt_enable(UART_ITF, USART_INT_RBNE);
+    return ok;
+}
+
 void usb_serial_init(void)
 {
     BaseType_t xReturned;
@@ -34,6 +34,13 @@
 #define UART_IRQ_ISR                   USART0_IRQHandler
 
 void usb_serial_init(void);
+bool usb_serial_ready(void);
+bool usb_serial_write(const uint8_t* data, uint32_t len);
+
+/*
+ * Called from the USB interrupt when a CDC1 IN transfer completed.
+ */
+void usb_serial_sent_from_isr(void);
 
 #ifdef __cplusplus
 }
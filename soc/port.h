@@ -43,17 +43,186 @@
 #define RV_TARGET_CONFIG_DMI_RETRIES                    (6)
 #endif
 
+/* most triggers used, how many the hart has is found out at connect */
 #ifndef RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM
 #define RV_TARGET_CONFIG_HARDWARE_BREAKPOINT_NUM        (8)
 #endif
 
-#ifndef RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM
-#define RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_NUM        (32)
+/*
+ * RAM given to the software breakpoint table, 16 bytes per breakpoint: 64 by
+ * default, which is what the 32 KB SRAM of the GD32VF103 leaves room for.
+ * The table is hashed by address, keep some room above the number needed.
+ */
+#ifndef RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_MEM
+#define RV_TARGET_CONFIG_SOFTWARE_BREAKPOINT_MEM        (1024)
+#endif
+
+#ifndef RV_TARGET_CONFIG_MEMORY_BULK_THRESHOLD
+#define RV_TARGET_CONFIG_MEMORY_BULK_THRESHOLD          (4)
+#endif
+
+#ifndef RV_TARGET_CONFIG_SYSTEM_BUS_ACCESS
+#define RV_TARGET_CONFIG_SYSTEM_BUS_ACCESS              (1)
+#endif
+
+/* dmstatus reads a single step waits for the halt before falling back to polling */
+#ifndef RV_TARGET_CONFIG_STEP_SPIN
+#define RV_TARGET_CONFIG_STEP_SPIN                      (64)
 #endif
 
 #define RV_TARGET_CONFIG_REG_NUM                        (33)
 
+/* memory read replies are read, encoded and sent in chunks of this size */
+#ifndef GDB_SERVER_CONFIG_STREAM_CHUNK_SIZE
+#define GDB_SERVER_CONFIG_STREAM_CHUNK_SIZE             (64)
+#endif
+
+/*
+ * While the target runs, dmstatus is polled back to back this many times
+ * after a resume or step, then at 1 ms and doubling up to the max interval.
+ * A command from GDB ends the wait at once.
+ */
+#ifndef GDB_SERVER_CONFIG_POLL_SPIN
+#define GDB_SERVER_CONFIG_POLL_SPIN                     (32)
+#endif
+
+#ifndef GDB_SERVER_CONFIG_POLL_MAX_MS
+#define GDB_SERVER_CONFIG_POLL_MAX_MS                   (64)
+#endif
+
+/* how long one icount run of '''monitor stepi''' may take */
+#ifndef GDB_SERVER_CONFIG_STEPI_TIMEOUT_MS
+#define GDB_SERVER_CONFIG_STEPI_TIMEOUT_MS              (1000)
+#endif
+
+/* GDB agent expressions, stack depth and opcodes run before giving up */
+#ifndef GDB_AGENT_CONFIG_STACK_SIZE
+#define GDB_AGENT_CONFIG_STACK_SIZE                     (32)
+#endif
+
+#ifndef GDB_AGENT_CONFIG_MAX_STEPS
+#define GDB_AGENT_CONFIG_MAX_STEPS                      (4096)
+#endif
+
+/* breakpoint conditions kept on the probe, and bytes of bytecode for each */
+#ifndef GDB_SERVER_CONFIG_COND_NUM
+#define GDB_SERVER_CONFIG_COND_NUM                      (4)
+#endif
+
+#ifndef GDB_SERVER_CONFIG_COND_SIZE
+#define GDB_SERVER_CONFIG_COND_SIZE                     (64)
+#endif
+
+/*
+ * Tracepoints: collected frames are kept in a ring buffer of
+ * GDB_TRACE_CONFIG_BUFFER_SIZE bytes in probe SRAM, a single frame holds at
+ * most GDB_TRACE_CONFIG_FRAME_SIZE bytes of registers and memory. Frames are
+ * taken from the buffer: the default fits the 4 byte frame header, the
+ * registers of an RV64 hart and 64 bytes of memory.
+ */
+#ifndef GDB_TRACE_CONFIG_BUFFER_SIZE
+#define GDB_TRACE_CONFIG_BUFFER_SIZE                    (768)
+#endif
+
+#ifndef GDB_TRACE_CONFIG_FRAME_SIZE
+#define GDB_TRACE_CONFIG_FRAME_SIZE                     (4 + 1 + 8 * RV_TARGET_CONFIG_REG_NUM + 64)
+#endif
+
+#ifndef GDB_TRACE_CONFIG_TRACEPOINT_NUM
+#define GDB_TRACE_CONFIG_TRACEPOINT_NUM                 (4)
+#endif
+
+/* bytes of condition bytecode and actions for each tracepoint */
+#ifndef GDB_TRACE_CONFIG_ACTION_SIZE
+#define GDB_TRACE_CONFIG_ACTION_SIZE                    (64)
+#endif
+
+#ifndef GDB_TRACE_CONFIG_TSV_NUM
+#define GDB_TRACE_CONFIG_TSV_NUM                        (4)
+#endif
+
+/* PC sampling histogram, 16 bit counters, and the default samples per second */
+#ifndef GDB_PROFILE_CONFIG_BUCKET_NUM
+#define GDB_PROFILE_CONFIG_BUCKET_NUM                   (256)
+#endif
+
+#ifndef GDB_PROFILE_CONFIG_RATE_HZ
+#define GDB_PROFILE_CONFIG_RATE_HZ                      (1000)
+#endif
+
+/* live watch, variables sampled and bytes of samples kept for the host */
+#ifndef GDB_LIVE_CONFIG_VAR_NUM
+#define GDB_LIVE_CONFIG_VAR_NUM                         (8)
+#endif
+
+#ifndef GDB_LIVE_CONFIG_BUFFER_SIZE
+#define GDB_LIVE_CONFIG_BUFFER_SIZE                     (512)
+#endif
+
+/* RTT, default range searched for the control block and how often it is polled */
+#ifndef GDB_RTT_CONFIG_SCAN_ADDR
+#define GDB_RTT_CONFIG_SCAN_ADDR                        (0x20000000)
+#endif
+
+#ifndef GDB_RTT_CONFIG_SCAN_SIZE
+#define GDB_RTT_CONFIG_SCAN_SIZE                        (0x8000)
+#endif
+
+#ifndef GDB_RTT_CONFIG_POLL_MS
+#define GDB_RTT_CONFIG_POLL_MS                          (10)
+#endif
+
+/* bytes read from the target and sent to the host at once */
+#ifndef GDB_RTT_CONFIG_CHUNK_SIZE
+#define GDB_RTT_CONFIG_CHUNK_SIZE                       (64)
+#endif
+
+/*
+ * Semihosting console output, bytes gathered into one '''O''' packet (at most
+ * (GDB_PACKET_BUFF_SIZE - 1) / 2) and how long they may wait.
+ */
+#ifndef GDB_SEMIHOST_CONFIG_BUFFER_SIZE
+#define GDB_SEMIHOST_CONFIG_BUFFER_SIZE                 (256)
+#endif
+
+#ifndef GDB_SEMIHOST_CONFIG_FLUSH_MS
+#define GDB_SEMIHOST_CONFIG_FLUSH_MS                    (20)
+#endif
+
+/* registers sent along with every stop reply, GDB register numbers */
+#ifndef GDB_SERVER_CONFIG_EXPEDITED_REGS
+#define GDB_SERVER_CONFIG_EXPEDITED_REGS                {32, 2, 8, 1} /* pc, sp, fp, ra */
+#endif
+
+/*
+ * Largest packet exchanged with GDB (advertised as PacketSize). The command,
+ * response and memory buffers are all sized from it and allocated from the
+ * FreeRTOS heap, (2 * GDB_PACKET_CONFIG_BUFF_NUM + 1) * GDB_PACKET_BUFF_SIZE
+ * in total.
+ */
+#ifndef GDB_PACKET_BUFF_SIZE
 #define GDB_PACKET_BUFF_SIZE                            (0x400)
+#endif
+
+/*
+ * Packet buffers per direction, so the next command can be received and the
+ * previous reply sent while one command is being served.
+ */
+#ifndef GDB_PACKET_CONFIG_BUFF_NUM
+#define GDB_PACKET_CONFIG_BUFF_NUM                      (2)
+#endif
+
+#ifndef GDB_PACKET_CONFIG_QUEUE_DEPTH
+#define GDB_PACKET_CONFIG_QUEUE_DEPTH                   (GDB_PACKET_CONFIG_BUFF_NUM)
+#endif
+
+/*
+ * In NoAckMode, '''X''' and '''vFlashWrite''' payloads are passed on in fragments of
+ * this size while the rest is still arriving. At most GDB_PACKET_BUFF_SIZE / 2.
+ */
+#ifndef GDB_PACKET_CONFIG_STREAM_SIZE
+#define GDB_PACKET_CONFIG_STREAM_SIZE                   (256)
+#endif
 
 void rv_board_init(void);
 